@@ -11,14 +11,151 @@ conducting the following commands :
    * statusNum
 While also supporting comments and blank inputLine inputs that begin with the "#" character.
 
-It provides an expansion for the variable $$.
+It provides an expansion for the variable $$, and also $? (exit code
+of the last command, built ins included), $! (pid of the last background command),
+$VAR and ${VAR} (environment), anywhere inside a word. A word that
+expands to nothing is dropped, as there is no quoting to keep it.
+$(command) is replaced by what the command prints (trailing newlines
+removed) and that output is split at blanks and newlines into separate
+arguments. Its output is captured in memory, never in a file : simple
+commands run in the shell with stdout on a memfd, anything that could
+change the shell (cd, assignments, loops, functions...) runs in a
+forked copy of the shell writing to a pipe.
+Words with *, ? or [...] in them are pathname patterns and are replaced
+by the sorted names they match (unchanged if nothing does; names
+starting with "." only match a pattern that starts with "." too).
+GLOBSORT=nosort leaves the names in directory order. Directory listings
+are cached by inode and kept as long as the directory's mtime does not
+change, so globbing a huge directory again does not read it again.
 It executes other commands by creating new processes using a function from the
 exec family of functions.
 It shall support input and output redirection and have custom headers for
 two signals, SIGINT and SIGTSTP
 
+External commands are launched with posix_spawn by default, which lets the
+C library use a vfork-style clone instead of copying our page tables for
+a child that is about to exec anyway. Starting the shell with --fork
+forces the classic fork() + exec path so the two can be compared.
+
+Commands can be chained with "|". Every stage of a pipeline is started
+at once in its own process group and the shell waits for all of them;
+status reports the last stage. With --splice, stages that are a plain
+"cat" or "tee FILE" are run by the shell itself with splice()/tee() so
+the data never gets copied through user space.
+
+echo, printf, pwd, true, false, test / [ and : are built in as well, so
+lines using them never start a process. Every built in honours "<" and
+">" (the shell's own descriptors are swapped for the duration) and the
+ones that have an exit code report it through status.
+
+Besides "<" and ">", a redirection can be ">>" (append), carry a file
+descriptor number ("2> errors", "2>>log") or duplicate/close one
+("2>&1", "0<&3", "3>&-"). Every target is opened exactly once, in the
+shell, close-on-exec, and all redirections are applied left to right
+before the command is exec'd.
+
+cd keeps the logical current directory in memory ($PWD, with ".."
+taken off lexically, and $OLDPWD), so neither cd nor pwd asks the
+kernel for it. "cd -" goes back, pushd / popd / dirs keep a directory
+stack, and relative names are looked up in CDPATH, with every CDPATH
+hit remembered for the session.
+
+Resolved command paths are kept in a small hash table keyed by the
+command name (like bash's hash builtin) so PATH is only walked the
+first time a command is run. "hash" shows the table and its hit rate,
+"hash -r" empties it.
+
+Commands on one line can be joined with ";" (run both), "&&" (run
+the second only if the first succeeded) and "||" (only if it failed).
+&& and || bind tighter than ; and group left to right, as in sh. The
+line is parsed into a small tree once and the whole tree is run in one
+trip through the main loop. A trailing & puts the last pipeline of the
+line in the background.
+
+There is also a little control flow :
+   for NAME in word ... ; do LIST ; done
+   while LIST ; do LIST ; done
+   function NAME { LIST ; }     (or NAME () { LIST ; })
+with break [N], continue [N] and return [N], NAME=value assignments
+(shell variables, $NAME finds them before the environment) and $1-$9 /
+$# inside functions. These may span lines; the shell keeps reading
+until the construct is complete. Each construct is parsed once : loop
+bodies are re-run from the tree without lexing again, and function
+bodies are copied out of the line so later calls reuse them. A loop
+only starts processes if its body runs an external command.
+
+Each line is split into tokens by one pass of lexLine(). The tokens
+point into the line itself (separators are overwritten with '\0'), and
+everything after that - builtin dispatch, redirection, pipelines and
+exec - works from the token array instead of rescanning the text.
+"smallsh --parse-bench script" times just that step per line.
+
+At the interactive prompt the shell waits in poll() on both the
+terminal and the SIGCHLD self pipe, so a background job that finishes
+while the prompt is up is reported right away and the prompt printed
+again, instead of on the next Enter.
+
+Interactive lines are kept in a history file ($HISTFILE, default
+~/.smallsh_history), each appended with one O_APPEND write so several
+shells can share it. At startup the file is only mapped; it is split
+into lines when an entry number is first needed. "!!", "!-N", "!N",
+"!TEXT" (last line starting with TEXT) and "!?TEXT?" (last line
+containing TEXT) recall a line, searching back from the end of the
+map, and "history [N]", "history -p PREFIX" and "history -s TEXT"
+list and search it.
+
+Children are collected with wait4(), so every command that finishes
+leaves its wall time, user / system CPU, peak RSS and context switches
+behind. "time cmd ..." (or "time a | b") prints them for one command,
+"status -v" shows them for the last foreground command, and background
+completion reports include them.
+
+"bench [-n N] [-w W] [--show-output] -- cmd args..." runs a command N
+times (after W unmeasured warm-up runs) through the same progFork()
+path as any command line and prints min / median / p95 / p99 / max of
+its wall time, CPU time and peak RSS. "bench --compare ... -- cmdA ...
+-- cmdB ..." alternates two commands run by run, so drift in the
+machine hits both alike, and prints the ratio of their medians.
+
+"parallel [-j N] -- cmd {} [::: item ...]" runs cmd once per item (the
+words after ":::", or the lines of stdin) with at most N running at
+once, N defaulting to the number of online CPUs. A new task is started
+as soon as one exits, each task's output is held in a memfd and
+written out in one piece when it is done, and a summary listing the
+failed items goes to stderr.
+
+"timeout [-k GRACE] DURATION cmd ..." runs a command with a deadline :
+the shell waits on a pidfd of the child with poll(), and when the time
+is up sends SIGTERM (and SIGCONT, in case it is stopped), then SIGKILL
+once GRACE (2s by default) has passed too. status then reads 124.
+"ulimit" sets CPU time, address space, open file and process limits
+(-t -v -n -u) for the commands the shell starts; they are applied with
+setrlimit in the child, between fork and exec, and never to the shell.
+
+On an interactive terminal the shell does job control : every command
+and pipeline runs in its own process group and is given the terminal
+while it is in the foreground, so ^C and ^Z reach only that job. A
+stopped job is listed by "jobs" and picked up again with "fg [%n]"
+or "bg [%n]". The foreground-only toggle is unchanged and separate
+from this : it is a SIGTSTP sent to the shell itself ("kill -SIGTSTP
+$$", or ^Z at an empty prompt). --no-job-control turns job control
+off and leaves every command in the shell's group.
+
+--trace=FILE writes a Chrome trace-event JSON file (loads in Perfetto
+or chrome://tracing) with a span for each phase of every command :
+reading and parsing the line, dispatch, opening and applying
+redirections, spawn / fork, and the wait. Spans are kept in a
+preallocated buffer and written out in batches, so tracing costs two
+clock reads per span; forked children write theirs directly.
+
+Scripts run in batch mode : "smallsh script.sh", or automatically when
+stdin is not a terminal. Batch mode does not print prompts, reads the
+script with mmap (or large read()s for pipes) and fully buffers stdout.
+
 General syntax of a command inputLine is :
 command [arg1 arg2 ...] [< input_file] [> output_file] [&]
+(plus [N]>> file, N< file, N> file, N>&M, N<&M and N>&- where N and M
+are single digits)
 
 Where items in the square brackets are optional.
 Assuming that a command is made up of words separated by spaces.
@@ -35,12 +172,16 @@ after output redirection
 This shell does not need to support any kind of quoting.
 
 It must however support command inputLines with a max length of 2048 characters and a max of
-512 arguments.
+512 arguments. (These are minimums : the line buffer and the argument
+lists grow as needed, so the only real limit is the system's ARG_MAX.
+Per-line memory comes from an arena that is rewound, not freed, after
+each command.)
 
 Error checking is not needed on the syntax of the command inputLine.
 
 ***********************************************************************************/
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
@@ -52,13 +193,97 @@ Error checking is not needed on the syntax of the command inputLine.
 #include <unistd.h>
 #include <sys/types.h>
 #include <assert.h>
+#include <ctype.h>
 #include <stdbool.h>
 #include <sys/types.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/uio.h>
+#include <limits.h>
 
 
 #define MAXIMUM_NUM_CHARACTERS    2048
 #define MAXIMUM_NUM_ARGS          512
 #define STRING_BUFFER             64
+#define HASH_BUCKETS              64
+#define SPLICE_CHUNK              (1 << 16)
+#define JOB_RUNNING               0
+#define JOB_DONE                  1
+#define JOB_STOPPED               2
+#define BATCH_BLOCK               (1 << 16)
+//First block of the per-line arena; later blocks double.
+#define ARENA_BLOCK               (1 << 14)
+#define PARSE_BENCH_ROUNDS        2000
+//--trace : spans held before a batch is written, and the longest
+// command name kept with one.
+#define TRACE_RING                4096
+#define TRACE_DETAIL              40
+//Room for one formatted span.
+#define TRACE_LINE                (256 + 2 * TRACE_DETAIL)
+//bench : default measured and warm-up runs
+#define BENCH_RUNS                10
+#define BENCH_WARMUP              1
+//Output of a parallel task is copied out in pieces of this size.
+#define PARALLEL_CHUNK            (1 << 16)
+//Seconds between the SIGTERM and the SIGKILL of a timeout, unless -k.
+#define TIMEOUT_KILL_AFTER        2.0
+//Poll interval when the kernel has no pidfd_open (before 5.3).
+#define TIMEOUT_POLL_MS           10
+//History file used when $HISTFILE is not set, under $HOME.
+#define HISTORY_FILE              ".smallsh_history"
+
+//Token types produced by lexLine()
+#define TOK_WORD                  0
+#define TOK_REDIR                 1
+#define TOK_PIPE                  2
+#define TOK_AMP                   3
+#define TOK_SEMI                  4
+#define TOK_AND                   5
+#define TOK_OR                    6
+//Line break inside a construct that spans lines
+#define TOK_NEWLINE               7
+//Command list tree nodes built by parseLine()
+#define NODE_PIPELINE             0
+#define NODE_SEQ                  1
+#define NODE_AND                  2
+#define NODE_OR                   3
+#define NODE_FOR                  4
+#define NODE_WHILE                5
+#define NODE_FUNCDEF              6
+//break / continue / return in progress (loopControl)
+#define LOOP_NONE                 0
+#define LOOP_BREAK                1
+#define LOOP_CONTINUE             2
+#define LOOP_RETURN               3
+//Deepest function call nesting allowed
+#define MAXIMUM_FUNCTION_DEPTH    1000
+//Token flags
+#define TOKF_DOLLAR               0x1
+#define TOKF_SUBST                0x2
+//Has a *, ? or [ in it : may be a pathname pattern.
+#define TOKF_GLOB                 0x4
+//Directory listings kept for globbing before the cache is emptied.
+#define DIRCACHE_MAX              256
+//Redirection kinds : "N< f", "N> f", "N>> f", "N>&M" / "N<&M", "N>&-"
+#define REDIR_IN                  0
+#define REDIR_OUT                 1
+#define REDIR_APPEND              2
+#define REDIR_DUP                 3
+#define REDIR_CLOSE               4
+//Redirections may name descriptors 0-9; the shell parks its own
+// descriptors at or above this.
+#define REDIR_FD_LIMIT            10
+//Returned by a built in that wants the real program run instead
+#define BUILTIN_EXTERNAL          (-1)
 
 //Globals
 
@@ -68,37 +293,565 @@ char   inputLine [MAXIMUM_NUM_CHARACTERS];
 char   inputBuffer[STRING_BUFFER];
 char * tempStr;
 int    smallShellpid, inputCmd, outputCmd, j;
-char   smallShellpidString[MAXIMUM_NUM_ARGS];
+//Our pid as text, made once at startup for $$.
+char   smallShellpidString[STRING_BUFFER];
+size_t smallShellpidLen = 0;
+//Pid of the last command started in the background, for $!.
+pid_t  lastBackground = 0;
+//Scratch space expandWord() builds a word in before it is copied
+// into lineArena. Doubles as needed and is kept.
+char*  expandScratch = NULL;
+size_t expandScratchCap = 0;
+//Pathname matches of the word being globbed (strings in lineArena).
+// Doubles as needed and is kept.
+char** globMatches = NULL;
+int    globCount = 0;
+int    globCap = 0;
+//Directory listings read for globbing, chained by inode number. A
+// listing is reused while the directory keeps its mtime, unless it
+// was read within a second of that mtime (a change in the same
+// clock tick would not show).
+struct dirListing {
+	dev_t  dev;
+	ino_t  ino;
+	struct timespec mtime;
+	time_t readAt;
+	char*  names;
+	int    count;
+	struct dirListing* next;
+};
+struct dirListing* dirCache[HASH_BUCKETS];
+int    dirCacheSize = 0;
+//What a forked $(...) wrote to its pipe, before it goes to lineArena.
+// Doubles as needed and is kept.
+char*  captureBuf = NULL;
+size_t captureCap = 0;
 pid_t forkProcess = 24;
+//Process group of a background pipeline being registered, 0 if the
+// command shares the shell's group.
+pid_t forkPgid = 0;
 bool backgroundFlag = true;
 int statusNum;
 int setExStatus;
-//Process array
-int processArrBG[40];
-int overallProcessCount;
-//Input array for the program
-char proginp[MAXIMUM_NUM_CHARACTERS];
+//Background jobs live in jobSlots (indexed by job number - 1) and are
+// also chained into jobsByPid so the reaper can find them in O(1).
+// Freed slot numbers go on freeSlots and are handed out again first.
+struct job {
+	int    id;
+	pid_t  pid;
+	pid_t  pgid;
+	char*  cmdLine;
+	time_t started;
+	struct timespec startMono;
+	int    state;
+	int    status;
+	//Filled in by wait4 when it finishes.
+	struct rusage usage;
+	double wallSeconds;
+	struct job* pidNext;
+};
+struct job** jobSlots = NULL;
+int   jobSlotCount = 0;
+int   jobSlotCapacity = 0;
+int*  freeSlots = NULL;
+int   freeSlotCount = 0;
+struct job** jobsByPid = NULL;
+int   pidBuckets = 0;
+int   liveJobs = 0;
+int   runningJobs = 0;
+
+//Batch (script) input. The script is either mmap'd whole or read in
+// big blocks into batchBuf; lines are found with memchr.
+bool   batchMode = false;
+bool   forceInteractive = false;
+char*  scriptPath = NULL;
+int    scriptFd = 0;
+char*  batchBuf = NULL;
+size_t batchLen = 0;
+size_t batchPos = 0;
+size_t batchCap = 0;
+bool   batchMapped = false;
+bool   batchEof = false;
+//Input line for the program. Grows (doubling) to fit the longest
+// line seen so far and is reused for every line after that.
+char*  proginp = NULL;
+size_t proginpCap = 0;
+//Longest line accepted : ARG_MAX, since a longer one could never be
+// exec'd anyway.
+long   lineMax = 0;
 bool backgrFlag = false;
 bool TSTPflag = false;
-int exitTheChild = -2;
+int exitTheChild = 0;
+//Exit code (0-255) of the last command, built ins included. This is
+// what && and || test and what $? shows; status keeps reporting
+// exitTheChild as the spec asks.
+int lastStatus = 0;
+//A foreground command on this line was killed by ^C (SIGINT), as
+// opposed to merely exiting 130; every loop running it stops.
+bool lineInterrupted = false;
+//Resource use of the last foreground command (all stages of a
+// pipeline added up) and when that command was started, for
+// "status -v". usageSink, when set, also collects it for "time".
+struct rusage lastUsage;
+double lastWall = 0;
+bool   lastUsageValid = false;
+struct timespec commandStart;
+struct rusage* usageSink = NULL;
+//One command's measurements for bench, one entry per run.
+struct benchSamples {
+	double* wall;
+	double* cpu;
+	double* rss;
+	int     failed;
+};
+//One running slot of "parallel" : the task's pid (0 : free), which
+// item it is working on and the memfd holding its output.
+struct parallelTask {
+	pid_t pid;
+	int   item;
+	int   outFd;
+};
+//Launch engine switch. posix_spawn unless --fork was given at startup.
+bool spawnEnabled = true;
+//Deadline of the running "timeout" (CLOCK_MONOTONIC) and how long
+// after the SIGTERM the SIGKILL follows. timeoutFired is set once the
+// SIGTERM went out.
+bool   timeoutArmed = false;
+bool   timeoutFired = false;
+struct timespec timeoutAt;
+double timeoutKillAfter = TIMEOUT_KILL_AFTER;
+//Resource limits "ulimit" set for children, in the order of
+// limitTable. limitsActive : at least one is set, so commands have
+// to be started with fork rather than posix_spawn.
+struct shellLimit {
+	int         resource;
+	char        option;
+	const char* name;
+	const char* unit;
+	rlim_t      scale;
+};
+const struct shellLimit limitTable[] = {
+	{ RLIMIT_CPU,    't', "cpu time",           "seconds", 1    },
+	{ RLIMIT_AS,     'v', "virtual memory",     "kbytes",  1024 },
+	{ RLIMIT_NOFILE, 'n', "open files",         "",        1    },
+	{ RLIMIT_NPROC,  'u', "max user processes", "",        1    },
+};
+#define NUM_LIMITS ((int)(sizeof(limitTable) / sizeof(limitTable[0])))
+struct rlimit childLimits[NUM_LIMITS];
+bool   limitSet[NUM_LIMITS];
+bool   limitsActive = false;
+extern char **environ;
+//Job control : on for an interactive terminal unless --no-job-control
+// was given. The terminal modes are put back after every foreground
+// job, in case it stopped halfway through changing them.
+bool jobControl = false;
+bool noJobControl = false;
+struct termios shellModes;
+
+//Resolved command cache. Each bucket is a chain of entries.
+struct hashEntry {
+	char* name;
+	char* path;
+	int   hits;
+	struct hashEntry* next;
+};
+struct hashEntry* cmdHashTable[HASH_BUCKETS];
+//PATH value the table was filled from. A different PATH empties it.
+char* hashedPath = NULL;
+int   hashHits = 0;
+int   hashMisses = 0;
+//Logical current directory and the one before it, as in $PWD and
+// $OLDPWD (NULL : not known). dirStack is the pushd stack, top last.
+char*  logicalPwd = NULL;
+char*  oldPwd = NULL;
+char** dirStack = NULL;
+int    dirStackCount = 0;
+int    dirStackCap = 0;
+//CDPATH hits, name -> absolute directory, for the CDPATH value in
+// cdHashedPath. Same entries as cmdHashTable.
+struct hashEntry* cdHashTable[HASH_BUCKETS];
+char*  cdHashedPath = NULL;
+
+//One redirection of a stage. fd is the descriptor the command sees;
+// source is the descriptor copied for REDIR_DUP. target is the file
+// name and openFd the shell's descriptor for it once opened.
+struct redirect {
+	int   fd;
+	int   mode;
+	int   source;
+	char* target;
+	int   openFd;
+};
+//One stage of a "|" pipeline. args points into lineArgs, redirs into
+// lineRedirs, in the order they were written.
+struct pipeStage {
+	char** args;
+	struct redirect* redirs;
+	int    numRedirs;
+};
+//--splice : run plain "cat" and "tee FILE" stages inside the shell
+// with splice()/tee() instead of exec'ing the real programs.
+bool spliceEnabled = false;
+
+//Per-line scratch memory. Blocks are chained and never freed;
+// arenaReset() rewinds them all, so after the first few lines a
+// session stops allocating and its footprint stays flat.
+struct arenaBlock {
+	struct arenaBlock* next;
+	size_t size;
+	size_t used;
+	char   data[];
+};
+struct arena {
+	struct arenaBlock* first;
+	struct arenaBlock* current;
+	struct arenaBlock* last;
+};
+struct arena lineArena = { NULL, NULL, NULL };
+//A point in an arena to roll back to (loop iterations).
+struct arenaMark {
+	struct arenaBlock* block;
+	size_t used;
+};
+
+//The current line, lexed. text points into proginp (or lineArena
+// for words that had $$ in them). lineTokens doubles as needed.
+struct token {
+	int   type;
+	int   flags;
+	char* text;
+};
+struct token* lineTokens = NULL;
+int   numTokens = 0;
+int   tokenCap = 0;
+//Parsed form of the same line : the stages of the pipeline, with args
+// pointing at token text. A plain command is one stage. All three
+// arrays live in lineArena, sized from numTokens.
+struct pipeStage* lineStages = NULL;
+char** lineArgs = NULL;
+struct redirect* lineRedirs = NULL;
+int   numStages = 0;
+//The line as a tree of ; && || nodes over pipelines. A pipeline node
+// only records its token range (and its trailing &); buildStages()
+// turns that into lineStages right before it runs, so $? and $! see
+// the commands before them on the same line.
+//   NODE_FOR     : tokenStart is the name, the words follow "in" up
+//                  to tokenEnd; left is the body
+//   NODE_WHILE   : left is the condition, right the body
+//   NODE_FUNCDEF : tokenStart is the name, tokenEnd the end of the
+//                  whole definition; left is the body
+struct cmdNode {
+	int   type;
+	struct cmdNode* left;
+	struct cmdNode* right;
+	int   tokenStart;
+	int   tokenEnd;
+	bool  background;
+};
+struct cmdNode* lineTree = NULL;
+//Tokens the running tree refers to : lineTokens, or a function's
+// own copy while its body runs.
+struct token* execTokens = NULL;
+//Token range of the command being run, for joinTokens().
+int   cmdTokenStart = 0;
+int   cmdTokenEnd = 0;
+//Recursive descent state for parseLine(). parseIncomplete means the
+// line ended inside a construct and readIn() should keep reading.
+int   parsePos = 0;
+bool  parseFailed = false;
+bool  parseIncomplete = false;
+struct cmdNode* lastPipeline = NULL;
+//Tokens of an unfinished construct, as text, waiting for the rest.
+char*  pendingBuf = NULL;
+size_t pendingCap = 0;
+
+//Functions, hashed by name. Each keeps its own copy of the tokens of
+// its definition and of the parsed body, so it outlives the line.
+struct function {
+	char*  name;
+	struct token* tokens;
+	char*  text;
+	struct cmdNode* body;
+	int    running;
+	struct function* next;
+};
+struct function* functionTable[HASH_BUCKETS];
+struct function* calledFunction = NULL;
+int    functionDepth = 0;
+//$1-$9 and $# of the function being run.
+char** posArgs = NULL;
+int    posCount = 0;
+//Shell variables (NAME=value and for loops), hashed by name.
+struct shellVar {
+	char*  name;
+	char*  value;
+	size_t valueCap;
+	struct shellVar* next;
+};
+struct shellVar* shellVars[HASH_BUCKETS];
+//Loops being run, and a break/continue/return on its way out.
+int    loopDepth = 0;
+int    loopControl = LOOP_NONE;
+int    loopLevels = 0;
+//--parse-bench : time lexLine()/parseLine() instead of running anything
+bool  parseBench = false;
+//--trace=FILE : finished spans wait in traceRing until it is full (or
+// the shell exits) and are then formatted into traceText and written
+// with one write(). tracePid tells the shell from its forked children.
+struct traceEvent {
+	const char* name;
+	long long   start;
+	long long   length;
+	pid_t       tid;
+	char        detail[TRACE_DETAIL];
+};
+char*  tracePath = NULL;
+int    traceFd = -1;
+pid_t  tracePid = 0;
+struct traceEvent* traceRing = NULL;
+int    traceCount = 0;
+char*  traceText = NULL;
+
+//Built in commands. builtinTable is kept sorted by name for bsearch.
+// setsStatus is false for status and exit, which the spec says status
+// ignores, and for the job/cache bookkeeping commands. cd (and
+// pushd / popd / dirs with it) does set it, so a failed cd shows up
+// in status.
+struct builtin {
+	const char* name;
+	int  (*run)(char* args[]);
+	bool setsStatus;
+};
+//Cursor for testCmd()'s little recursive descent parser.
+char** testArgs;
+int    testCount;
+int    testPos;
+bool   testError;
+
+//SIGCHLD self-pipe. The handler writes a byte to the write end, the
+// main loop drains the read end and reaps whatever has finished.
+int childPipe[2] = { -1, -1 };
+//Background completions waiting to be printed at the next prompt.
+// The pid makes sure the slot still holds the same job.
+struct completion {
+	int   id;
+	pid_t pid;
+};
+struct completion* doneQueue = NULL;
+int doneCount = 0;
+int doneCapacity = 0;
+//Interactive input read past the end of the current line, kept for
+// the next readPromptLine().
+char*  typedBuf = NULL;
+size_t typedLen = 0;
+size_t typedCap = 0;
+bool   typedEOF = false;
+//Command history (interactive only). histMap is the history file as
+// it was at startup, mapped and never parsed up front; histLines, the
+// offset of each of its lines, is built the first time an entry
+// number is needed (-1 : not yet). Lines typed since are appended to
+// the file through histFd and kept in histSession.
+int     histFd = -1;
+char*   histMap = NULL;
+size_t  histMapLen = 0;
+size_t* histLines = NULL;
+int     histMapCount = -1;
+char**  histSession = NULL;
+int     histSessionCount = 0;
+int     histSessionCap = 0;
 
 //Function Prototypes
 
-void readIn();
+bool readIn();
+ssize_t readPromptLine(const char* prompt);
+void initInput();
+bool readBatchLine();
+void syncScriptOffset();
+void resumeScriptOffset();
+void initHistory();
+void addHistory(const char* line);
+bool expandHistory();
+void indexHistory();
+int  historyTotal();
+const char* historyEntry(int number, size_t* len);
+const char* historyRecent(int back, size_t* len);
+const char* historyFind(const char* text, size_t textLen, bool prefix, size_t* len);
+bool historyMatch(const char* line, size_t len, const char* text, size_t textLen, bool prefix);
+const char* mapLineBefore(ssize_t* end, size_t* len);
+int  historyCmd(char* args[]);
+void printHistory(int number, const char* text, size_t len);
 void initSigs();
-void searchBackg();
-void checkInput(char out[], char in[]);
+void lexLine(char* line);
+void addToken(int type, int flags, char* text);
+bool parseLine();
+struct cmdNode* newNode(int type, struct cmdNode* left, struct cmdNode* right);
+struct cmdNode* parseList();
+struct cmdNode* parseAndOr();
+struct cmdNode* parseCommand();
+struct cmdNode* parsePipeline();
+struct cmdNode* parseFor();
+struct cmdNode* parseWhile();
+struct cmdNode* parseFunction();
+struct cmdNode* parseGroup();
+struct cmdNode* parseDoGroup();
+void parseError(int pos);
+bool isWord(int pos, const char* word);
+bool isTerminator(int pos);
+size_t saveTokens();
+bool buildStages(struct cmdNode* node);
+void runCommandList(struct cmdNode* node);
+void runFor(struct cmdNode* node);
+void runWhile(struct cmdNode* node);
+bool loopShouldStop();
+int  exitCode(int status);
+struct arenaMark arenaSave(struct arena* pool);
+void arenaRestore(struct arena* pool, struct arenaMark mark);
+struct function* findFunction(const char* name);
+void defineFunction(struct cmdNode* node);
+struct cmdNode* copyTree(struct cmdNode* node, int shift);
+void freeTree(struct cmdNode* node);
+int  callFunction(char* args[]);
+bool isAssignment(const char* word);
+bool assignVars(char* args[]);
+void setVar(const char* name, const char* value);
+char* lookupVar(const char* name);
+int  breakCmd(char* args[]);
+int  continueCmd(char* args[]);
+int  loopJump(char* args[], int kind);
+int  returnCmd(char* args[]);
+char* expandWord(char* word);
+void expandAppend(size_t* outLen, const char* text, size_t textLen);
+char* matchParen(char* open);
+char* commandSubst(char* text, size_t textLen, size_t* outLen);
+bool  substInShell(struct cmdNode* node);
+char* captureInShell(struct cmdNode* tree, size_t* outLen);
+char* captureInChild(struct cmdNode* tree, size_t* outLen);
+int   countFields(const char* text);
+int   splitFields(char* text, char** fields);
+void  growArgs(int argCount, int need, int* argCap);
+bool  isPattern(const char* word);
+int   expandGlob(const char* pattern);
+void  globWalk(char* path, size_t pathLen, char** parts, int numParts);
+void  addMatch(const char* path);
+struct dirListing* readListing(const char* dir);
+void  clearDirCache();
+int   compareString(const void* a, const void* b);
+void* arenaAlloc(struct arena* pool, size_t size);
+void arenaReset(struct arena* pool);
+void growLine(size_t need);
+void joinTokens(char* out, size_t outSize);
+void runParseBench();
+void initTrace();
+long long traceBegin();
+void traceEnd(const char* name, long long start, const char* detail);
+size_t traceFormat(char* out, const struct traceEvent* event);
+void traceFlush();
+void traceClose();
 bool strEquals(const char* a, const char* b);
-void attachChildpid();
 void checkParents();
-void processTracker();
+bool processTracker();
+void catchSIGCHLD(int signo);
+void reapChildren();
+void collectChild(pid_t donePid, int childStatus, const struct rusage* usage);
+void queueCompletion(struct job* doneJob);
+struct job* addJob(pid_t pid, pid_t pgid, const char* cmdLine);
+struct job* findJobByPid(pid_t pid);
+struct job* findJobById(int id);
+struct job* findJobArg(const char* arg);
+void finishJob(struct job* doneJob, int status, const struct rusage* usage);
+void removeJob(struct job* oldJob);
+void growPidBuckets();
+int  jobsCmd(char* args[]);
+int  waitCmd(char* args[]);
+bool killJobCmd(char* args[]);
+int  killCmd(char* args[]);
+int  parseSignal(const char* name);
+void waitForeground(pid_t pid, int* status, struct rusage* usage);
+void timeCommand();
+void timeoutCommand();
+double parseDuration(const char* text);
+void waitDeadline(const pid_t* pids, int count, pid_t pgid);
+void deadlineSignal(const pid_t* pids, int count, pid_t pgid, int signo);
+double secondsUntil(const struct timespec* when);
+int  ulimitCmd(char* args[]);
+void printLimit(int l, bool named);
+void applyLimits();
+void addUsage(struct rusage* total, const struct rusage* part);
+void printUsage(FILE* out, const char* lead, double wall, const struct rusage* usage);
+double secondsSince(const struct timespec* start);
+int  benchCmd(char* args[]);
+bool benchRun(struct pipeStage* stage, struct benchSamples* samples, int run);
+void benchReport(struct pipeStage* stage, struct benchSamples* samples, int runs);
+int  compareDouble(const void* a, const void* b);
+double percentile(double* sorted, int count, int percent);
+int  parallelCmd(char* args[]);
+char** parallelItems(char** itemBuf, int* numItems);
+bool parallelStart(struct parallelTask* task, char* cmdArgs[], const char* item, pid_t* pgid);
+void parallelOutput(struct parallelTask* task);
+bool waitForegroundJob(pid_t* pids, int count, pid_t pgid, int* status, struct job* fgJob);
+bool giveTerminal(pid_t pgid);
+void takeTerminal();
+void initJobControl();
+void childSignals();
+void jobSpawnAttrs(posix_spawnattr_t* attrs, pid_t pgid);
+struct job* pickJob(char* args[]);
+int  fgCmd(char* args[]);
+int  bgCmd(char* args[]);
 void shiftValues(int a, int b, bool c, int d);
 void bCMDs();
-void runDUP(int a, int b, int c, char* cArg[MAXIMUM_NUM_ARGS]);
 void removeEndNewLine(char *removeItem);
 void progFork();
+bool spawnCmd();
 void redirectionCms();
 void catchSIGTSTP();
+void parseOptions(int argc, char* argv[]);
+unsigned int hashName(const char* name);
+char* lookupCmd(const char* name);
+void forgetCmd(const char* name);
+void clearCmdHash();
+int  hashCmd(char* args[]);
+const struct builtin* findBuiltin(const char* name);
+int  compareBuiltin(const void* key, const void* entry);
+void runBuiltin(const struct builtin* cmd, struct pipeStage* stage);
+int  statusCmd(char* args[]);
+int  cdCmd(char* args[]);
+int  pushdCmd(char* args[]);
+int  popdCmd(char* args[]);
+int  dirsCmd(char* args[]);
+void printDirs(bool verbose);
+bool changeDir(const char* dir, bool show);
+char* logicalPath(const char* dir);
+const char* cdpathLookup(const char* name);
+void initPwd();
+int  exitCmd(char* args[]);
+int  echoCmd(char* args[]);
+int  printfCmd(char* args[]);
+int  pwdCmd(char* args[]);
+int  trueCmd(char* args[]);
+int  falseCmd(char* args[]);
+int  testCmd(char* args[]);
+int  putEscape(const char* seq, bool echoStyle, bool* stop);
+long long printfNumber(const char* arg, int* status);
+bool testOr();
+bool testAnd();
+bool testNot();
+bool testPrimary();
+bool testUnary(const char* op, const char* arg);
+bool testBinary(const char* left, const char* op, const char* right);
+long long testInteger(const char* arg);
+void execCmd(char* cArg[]);
+bool parseRedirWord(const char* word, struct redirect* redir);
+bool openRedirects(struct pipeStage* stage);
+void closeRedirects(struct pipeStage* stage);
+bool applyRedirects(struct pipeStage* stage);
+void addRedirectActions(struct pipeStage* stage, posix_spawn_file_actions_t* fileActions);
+int spawnResolved(pid_t* pid, char* cArg[], posix_spawn_file_actions_t* fileActions,
+                  posix_spawnattr_t* attrs);
+void runPipeline();
+pid_t launchStage(struct pipeStage* stage, int inFd, int outFd, int spareFd, pid_t pgid);
+bool isSpliceStage(char* args[]);
+void spliceStage(char* args[]);
+bool spliceCopy(int inFd, int outFd);
 
 
 /*************************************************
@@ -151,31 +904,6 @@ void catchSIGTSTP(){
 
 }
 
-/**************************************************
- * 
- * Function name : searchBackg()
- * 
- * Description   :
- * This function searches through the background to check to
- * see if the background flag has been set.
- * 
- * Input : None
- * 
- * Output : Background processes, strings
- * 
-***************************************************/
-void searchBackg(){
-
-	char bckgroundArr[MAXIMUM_NUM_CHARACTERS];
-    //When there is no signal to catch we switch into background mode.
-	if(TSTPflag == false){
-		//Set background flag.
-		backgrFlag = true;
-	}
-	//Utilize strcpy to capture bckgroundArr and put that into proginp
-	strcpy(proginp, strncpy(bckgroundArr, proginp, (strlen(proginp) - 2)));
-}
-
 /*************************************************
 * Function name : readIn
 * Description : gets input from the user.
@@ -205,493 +933,7155 @@ void readIn(){
 
 // colon stopped printing out, unknown reason.
 // Colon is back! 
-void readIn (){
-
-	char isOutput[5] = { 0 };
-    fflush(stdout);
-    printf(": ");
-	fgets(proginp, sizeof(proginp), stdin);
-    fflush(stdout);
-	//Grab input line and clean it. (remove the null terminator : '\0')
-	proginp[strcspn(proginp, "\n")] = '\0';
+// Returns false once there is no more input (EOF), which ends the shell.
+// In batch mode the line comes from the script buffer and there is
+// no prompt and no flushing.
+bool readIn (){
 
-	//Run the check input Function outside of this
-	//This will check the input for any instances of
-	// echo, & signals to stop, or $$
+	ssize_t lineLen;
+	size_t  pendingLen = 0;
+	long long spanStart;
 
-	checkInput(strncpy(isOutput, proginp, 4), proginp);
+	while (true){
+		spanStart = traceBegin();
+		if (batchMode == true){
+			if (readBatchLine() == false){
+				break;
+			}
+		}else{
+			lineLen = readPromptLine((pendingLen > 0) ? "> " : ": ");
+			if (lineLen < 0){
+				break;
+			}
+			if (lineLen >= lineMax){
+				printf("line too long (%ld bytes, limit %ld)\n", (long)lineLen, lineMax);
+				fflush(stdout);
+				proginp[0] = '\0';
+			}
+			//!! / !n / !text recall, then the line goes on the history.
+			if (expandHistory() == false){
+				proginp[0] = '\0';
+			}
+			addHistory(proginp);
+		}
 
-}
+		//The rest of an unfinished for/while/function : put the part
+		// we already have in front of the new line.
+		if (pendingLen > 0){
+			lineLen = strlen(proginp);
+			growLine(pendingLen + lineLen + 1);
+			memmove(proginp + pendingLen, proginp, lineLen + 1);
+			memcpy(proginp, pendingBuf, pendingLen);
+		}
 
-/*****************************************************************
- * Function name ; strEquals
- * 
- * Description:
- * String comparison helper function
- * This helps ensure and WRAP the strcmp function
- * This also helps absolutely ensure that correct
- * comparisons and judgements on those are being made.
- * 
- * Input : 
- *  string1 and string2.
- * 
- * Output : 
- *  Bool. (True or false). 
- * 
-*****************************************************************/
+		traceEnd("read", spanStart, NULL);
 
-bool strEquals(const char* a, const char* b) {
+		//Split the line into tokens once; everything after this works
+		// from lineTokens / lineTree.
+		spanStart = traceBegin();
+		lexLine(proginp);
+		if (parseLine() == true){
+			traceEnd("parse", spanStart, NULL);
+			return true;
+		}
+		traceEnd("parse", spanStart, NULL);
+		if (parseIncomplete == false){
+			lineTree = NULL;
+			return true;
+		}
+		pendingLen = saveTokens();
+	}
 
-	if(strcmp(a , b) < 0){
-		return false;
-	} else if (strcmp(a , b) > 0){
-		return false;
-	} else if (strcmp(a , b) == 0){
-		return true;
+	//End of input.
+	if (pendingLen > 0){
+		printf("syntax error : unexpected end of input\n");
+		fflush(stdout);
 	}
+	return false;
 }
 
-/*****************************************************************
- * Function name : checkInput
- * 
- * Description :
- * This function checks the input from both the user and or
- * scripts that are being read into the program. It searches for
- * cases where the echo command can be found, it then looks for
- * the TSTP signal and $$ signals. The case where $$ happens
- * the stop signal should not be allowed to activate.
- * 
- * Input  : 
- * char out[], char in[]
- * 
- * Output :
- *  No output
- * 
- * Other functions called :
- *  searchBackg() will be called if the required parameters for it
- *  are made. Namely when the echo command is initiated, there
- *  exists an '&' within the string
- * 
- *  catchSIGTSTP(); will be called if the stop signal is initiated.
- * 
-*****************************************************************/
+/*************************************************
+* Function name : readPromptLine
+*
+* Description :
+*	Prints the prompt and reads one line of interactive input
+*	into proginp, without the newline. Instead of blocking in a
+*	read, it waits in poll() on stdin and on the SIGCHLD self
+*	pipe : when a background job finishes, processTracker()
+*	reports it straight away and the prompt is printed again
+*	under the message. A ^Z (the foreground-only toggle) also
+*	gets a fresh prompt. Whatever the user had already typed
+*	stays in the terminal's line buffer and is still read.
+*
+*	read() may return more than one line (paste, -i on a pipe);
+*	the rest waits in typedBuf for the next call.
+*
+* Input  : prompt
+* Output : Length of the line, -1 at end of input.
+*
+**************************************************/
+ssize_t readPromptLine(const char* prompt){
 
+	struct pollfd waitFor[2];
+	char*   newline;
+	size_t  lineLen;
+	ssize_t got;
+	int     seenSignals = numSignals;
 
-void checkInput(char out[], char in[]){
+	fflush(stdout);
+	printf("%s", prompt);
+	fflush(stdout);
 
-	//Initialize Comparison variables
-	const char inputChar[2]    = "<";
-    const char outputChar[2]   = ">";
-    const char poundChar[2]    = "#";
-    const char doubleMoney[2]  = "$$";
-    const char statusStr[6]    = "status";
-    const char cdStr[2]        = "cd";
-    const char empty[2]        = "";
-    const char andSymb[2]      = "&";
-    const char echoS[5]        = "echo";
-    const char spaceChar[2]    = " ";
-    const char stpsignal[5]    = "TSTP";
-	const char exit[6]         = "exit";
+	while (true){
+		newline = (typedLen > 0) ? memchr(typedBuf, '\n', typedLen) : NULL;
+		if (newline != NULL || (typedEOF == true && typedLen > 0)){
+			lineLen = (newline != NULL) ? (size_t)(newline - typedBuf) : typedLen;
+			growLine(lineLen + 1);
+			memcpy(proginp, typedBuf, lineLen);
+			proginp[lineLen] = '\0';
+			typedLen -= (newline != NULL) ? lineLen + 1 : lineLen;
+			memmove(typedBuf, typedBuf + lineLen + (newline != NULL), typedLen);
+			return lineLen;
+		}
+		if (typedEOF == true){
+			return -1;
+		}
 
-	//In the case of "echo"
-	if (strEquals(out, echoS) != true){
-		char* search;
-		search = strchr(in, '&');
-		if (search != NULL){
-			searchBackg();
+		waitFor[0].fd = STDIN_FILENO;
+		waitFor[0].events = POLLIN;
+		waitFor[1].fd = childPipe[0];
+		waitFor[1].events = POLLIN;
+		if (poll(waitFor, 2, -1) < 0){
+			//SIGTSTP or SIGCHLD came in; only the first needs a new prompt.
+			if (errno == EINTR && numSignals != seenSignals){
+				seenSignals = numSignals;
+				printf("%s", prompt);
+				fflush(stdout);
+			}
+			continue;
+		}
+
+		if (waitFor[1].revents & POLLIN){
+			if (processTracker() == true){
+				printf("%s", prompt);
+				fflush(stdout);
+			}
+		}
+		if (waitFor[0].revents & (POLLIN | POLLHUP | POLLERR)){
+			if (typedCap - typedLen < STRING_BUFFER){
+				typedCap = (typedCap == 0) ? MAXIMUM_NUM_CHARACTERS : typedCap * 2;
+				typedBuf = realloc(typedBuf, typedCap);
+			}
+			got = read(STDIN_FILENO, typedBuf + typedLen, typedCap - typedLen);
+			if (got < 0 && errno == EINTR){
+				continue;
+			}
+			if (got <= 0){
+				typedEOF = true;
+			}else{
+				typedLen += got;
 			}
 		}
-	//In the case of "$$"
-	char* search;
-	search = strstr(in, stpsignal);
-	if (search == NULL && strstr(in, "$$") != NULL){
-		char expComd[MAXIMUM_NUM_CHARACTERS] = { 0 };
-		int temp_pid = getppid();
-		//Utilize strlen to get the length of our input.
-		// subtracting it by 2 will remove the $$
-		strcpy(proginp, strncpy(expComd, proginp, (strlen(proginp) - 2)));
-		//Attach shell PID at the end
-		sprintf(expComd, "%d", temp_pid);
-		strcat(proginp, expComd);
-	}
-	//In the case of "TSTP" run the catchsigtstp function.
-	search = strstr(in, "TSTP");
-	if (search != NULL){
-		catchSIGTSTP();
 	}
 }
 
-/*****************************************************************
-* Function name : bCMDs
+/*************************************************
+* Function name : saveTokens
+*
 * Description :
-* 
-*	This function checks for built in functions
-*	along the lines of cd, status, exit, comments
-*   There are multiple if and else if clauses
-*   in this function that are used to check
-*   the program input. 
+*	Writes the tokens of an unfinished construct back out as
+*	text, ending with a line break, into pendingBuf. The next
+*	line is appended to it and the whole thing lexed again.
+*	No quoting means the words come back exactly as they were.
 *
-* This program effects  :
-*  proginp (not directly passed in), exitTheChild, backgrFlag
-
-* Outputs : 
-*  output statements, status statements, 
-*  directories (home and newly created),
-*  
-* This program will call progFork(); if certain requirements are met
+* Input  : None (lineTokens)
+* Output : Length of pendingBuf.
 *
-* TODO : Refactor & clean up.
-*****************************************************************/
-void bCMDs(){
+**************************************************/
+size_t saveTokens(){
 
-	//Initialize our comparison character strings
-	const char cdStr[4]        = "cd";
-	const char statusStr[6]    = "status";
-	const char exitStr[6]      = "exit";
-	const char endOp[6]      = "/";
-	const char poundDefine[4]  = "#";
-	const char homeDefine[6]  = "HOME";
-
-	//Need to initialize current working directory arr--
-	//Getting ready to gather the new pathway.
-	char currentDir[MAXIMUM_NUM_CHARACTERS];
-	char* pathParse;
-
-    //First we search for the comment command : Nothing happens here.
-	if (strncmp(proginp, poundDefine, 1) == 0){
-		
-	}
+	size_t used = 0;
+	size_t need;
+	int i;
 
-	//Then we search for the "status" command
-	else if (strEquals(proginp, statusStr) == true){
-		//Should change over the course of the execution of code
-		// at run time.
-		printf("exit value %d\n", WEXITSTATUS(exitTheChild));
-		fflush(stdout);
+	for (i = 0; i <= numTokens; i++){
+		need = (i < numTokens) ? strlen(lineTokens[i].text) + 1 : 2;
+		while (used + need > pendingCap){
+			pendingCap = (pendingCap == 0) ? MAXIMUM_NUM_CHARACTERS : pendingCap * 2;
+			pendingBuf = realloc(pendingBuf, pendingCap);
+		}
+		if (i < numTokens){
+			memcpy(pendingBuf + used, lineTokens[i].text, need - 1);
+		}else{
+			pendingBuf[used] = '\n';
+		}
+		pendingBuf[used + need - 1] = ' ';
+		used += need;
 	}
+	return used;
+}
 
-	// Then look for the "cd" command
-	else if (strncmp(proginp, cdStr, 2) == 0){
-		if (pathParse = strstr(proginp, " ")){
-			//Gather the current directory
-			strcat(strncat(getcwd(currentDir, sizeof(currentDir)), 
-			endOp, 1), pathParse + 1);
-			chdir(currentDir);
-		}else if (pathParse = strstr(proginp, " ") == NULL ){
-			//use the built in function getenv to get our home directory.
-			chdir(getenv(homeDefine));
-		}
+/*************************************************
+* Function name : initInput
+*
+* Description :
+*	Sets up the line buffer and its ARG_MAX limit, then
+*	decides between interactive and batch input. Batch mode is
+*	used for "smallsh script.sh" and whenever stdin is not a
+*	terminal (heredocs, pipes, redirected files) unless -i was
+*	given. A regular file is mapped whole; anything else is
+*	read in BATCH_BLOCK sized chunks by readBatchLine().
+*
+*	stdout is switched to full buffering in batch mode. Anything
+*	that starts a child flushes it first so output still comes
+*	out in order.
+*
+* Input  : None (scriptPath, forceInteractive)
+* Output : Error and exit if the script can not be opened.
+*
+**************************************************/
+void initInput(){
+
+	struct stat scriptInfo;
+	void* mapped;
+
+	lineMax = sysconf(_SC_ARG_MAX);
+	if (lineMax < MAXIMUM_NUM_CHARACTERS){
+		lineMax = MAXIMUM_NUM_CHARACTERS;
 	}
+	growLine(MAXIMUM_NUM_CHARACTERS);
 
-	//Last search we conduct is for the exit command
-	else if (strEquals(proginp, exitStr) == true){
-		//If an exit command is found we set the program's exit flag.
-		//ezpz
-		backgroundFlag = false;									
+	if (scriptPath != NULL){
+		scriptFd = open(scriptPath, O_RDONLY | O_CLOEXEC);
+		if (scriptFd < 0){
+			perror(scriptPath);
+			exit(127);
+		}
+	}else if (forceInteractive == true || (isatty(0) && parseBench == false)){
+		return;
 	}
+	batchMode = true;
+	setvbuf(stdout, NULL, _IOFBF, BATCH_BLOCK);
 
-	//If and only if none of those appear in the proginp we fork our process.
-	//Reduces unexpected behavior.
-	else if (strEquals(proginp, statusStr) == false && strncmp(proginp, cdStr, 2) != 0 
-	        && strEquals(proginp, exitStr) == false && 
-			strncmp(proginp, poundDefine, 1) != 0 ){
-	
-			progFork();
+	if (fstat(scriptFd, &scriptInfo) == 0 && S_ISREG(scriptInfo.st_mode) && 
+	    scriptInfo.st_size > 0){
+		mapped = mmap(NULL, scriptInfo.st_size, PROT_READ, MAP_PRIVATE, scriptFd, 0);
+		if (mapped != MAP_FAILED){
+			madvise(mapped, scriptInfo.st_size, MADV_SEQUENTIAL);
+			batchBuf = mapped;
+			batchLen = scriptInfo.st_size;
+			batchMapped = true;
+			//stdin may already have been partly read by someone else.
+			if (scriptFd == 0){
+				off_t startAt = lseek(0, 0, SEEK_CUR);
+				batchPos = (startAt > 0 && (size_t)startAt < batchLen) ? (size_t)startAt : 0;
+			}
+		}
 	}
-    
-	backgrFlag = false;
 }
 
-/*****************************************************************
-*
-* Function nmae : processtracker()
-*
-* Description   :
-*	This is the process tracker. it checks to see if children
-*	from forked processes and the rest of the program have recieved
-*	exit signals or other signals to end those processes. Once the
-*	check is done on them the process for that background process
-*	is revealed with a print statement. This also will print the
-*	terminating signal and OR the exit value for that process once
-*	it is terminated.
+/*************************************************
+* Function name : readBatchLine
 *
-* inputs       : None
+* Description :
+*	Hands the next script line to proginp (grown to fit, up to
+*	lineMax). memchr finds the
+*	newline in the buffer; when the buffer runs out (pipes only)
+*	the unread tail is moved to the front and another block is
+*	read, doubling the buffer if a single line does not fit.
 *
-* outputs      : Print statements based on the background process ID
-*				 exit statements based on WEXITSTATUS(exitTheChild)
+* Input  : None
+* Output : false at the end of the script.
 *
-*****************************************************************/
-void processTracker(){
+**************************************************/
+bool readBatchLine(){
 
-	int i;
-	bool processExists = false;
-	int processId = waitpid(processArrBG[i], &exitTheChild, WNOHANG);
-	if(processId > 0){
-		processExists = true;
-	}
-	//Loop through each element
-	for(i = 0; i < overallProcessCount; i++){
-		if (processExists == true){
-			int checkifexitmethod = WIFEXITED(exitTheChild);
-			int checkifSign = WIFSIGNALED(exitTheChild);
-			int setSigStatus = 0;
-
-			if (checkifSign == true){
-				printf("\n");
-				printf("______________________________________\n");
-				printf("| background pid for the process : %d \n", processArrBG[i]);
-				setSigStatus = WTERMSIG(exitTheChild);
-				printf("| process was terminated by signal : %d \n", setSigStatus);
-				printf("|_____________________________________| \n");
-				fflush(stdout);
+	char*   lineStart;
+	char*   newLine;
+	size_t  lineLen;
+	ssize_t bytesRead;
 
-			}
-			//TODO: Fix this
-			//This prints the correct exit value approximately
-			// 3/4's of the time? the rest of the time
-			// it just does not print anything at all.
-			// TODO complete I believe!
-			else if (setSigStatus != 0){
-				setExStatus = WEXITSTATUS(exitTheChild);
-				printf("exit value for that process : %d\n", setExStatus);
-				fflush(stdout);
-			//Should act as a catcher for the rest of the cases
-			// exit value would be printed.
-			} else if (checkifexitmethod){
-				setExStatus = WEXITSTATUS(exitTheChild);
-				printf("exit value for that process : %d\n", setExStatus);
+	while (true){
+		lineStart = batchBuf + batchPos;
+		newLine = (batchPos < batchLen) ? memchr(lineStart, '\n', batchLen - batchPos) : NULL;
+		if (newLine != NULL || ((batchMapped == true || batchEof == true) && batchPos < batchLen)){
+			lineLen = (newLine != NULL) ? (size_t)(newLine - lineStart) : batchLen - batchPos;
+			batchPos += lineLen + (newLine != NULL);
+			if (lineLen >= (size_t)lineMax){
+				printf("line too long (%ld bytes, limit %ld)\n", (long)lineLen, lineMax);
 				fflush(stdout);
+				lineLen = 0;
 			}
-			
+			growLine(lineLen + 1);
+			memcpy(proginp, lineStart, lineLen);
+			proginp[lineLen] = '\0';
+			return true;
+		}
+		if (batchMapped == true || batchEof == true){
+			return false;
+		}
+
+		//Out of buffered input : keep the partial line and read more.
+		memmove(batchBuf, lineStart, batchLen - batchPos);
+		batchLen -= batchPos;
+		batchPos = 0;
+		if (batchLen == batchCap){
+			batchCap = (batchCap == 0) ? BATCH_BLOCK : batchCap * 2;
+			batchBuf = realloc(batchBuf, batchCap);
+		}
+		bytesRead = read(scriptFd, batchBuf + batchLen, batchCap - batchLen);
+		if (bytesRead < 0 && errno == EINTR){
+			continue;
+		}
+		if (bytesRead <= 0){
+			batchEof = true;
+		}else{
+			batchLen += bytesRead;
 		}
 	}
 }
 
-/*****************************************************************
-*
-* Function name : progfork
-*
+/*************************************************
+* Function name : syncScriptOffset
 *
-* Description   :
-*				This will fork the current running program. 
-*               This process spawns children processes from it. 
-*				The new children made from this function
-*				can run built-in redirectional commands. Once this
-*				is done running it will then check the parents.
+* Description :
+*	When the script is our own stdin, a child that reads stdin
+*	should start at the next script line, not wherever mmap left
+*	the file offset (which never moves). Called before launching
+*	children only, so builtin lines cost nothing. Pipes can not
+*	seek; children reading a piped script see what is left after
+*	the block we already read, as with any buffered reader.
 *
+* Input  : None
+* Output : None
 *
-******************************************************************/
-void progFork(){
+**************************************************/
+void syncScriptOffset(){
 
-	const char killstr[6]        = "kill";
-	//Create child process with fork
-	forkProcess = fork();
-	if (numSignals > 0 && strstr(proginp, killstr) != NULL){
-		attachChildpid();
-	}
-	//Roll through child commands
-	if(forkProcess == 0){
-		redirectionCms();								
-	}
-	//Check Parent case
-	else{
-		checkParents();
+	if (batchMode == true && batchMapped == true && scriptFd == 0){
+		lseek(0, batchPos, SEEK_SET);
 	}
 }
 
-
-/*****************************************************************
-*
-* Function name : checkParents
-*
-*
-* Description   :
-*				 This rolls through parent processes and either
-*				  will set them to sleep and wait for child processes
-*				  to finish. It keeps track of the parent process count
-*				  each time this function is ran it will increase that count.
-*				  It will then output the background process ID for any process
-*				  that passes through this function. If the background processes falg
-*				  is found to not be set throughout the execution of the program / process
-*				  then it will make the parent process wait for the child to be executed.
+/*************************************************
+* Function name : resumeScriptOffset
 *
+* Description :
+*	The other half of syncScriptOffset : once the child is done,
+*	carry on from wherever it left stdin, so a command that ate
+*	the rest of the script ("cat") ends it just like in bash.
 *
 * Input  : None
-* Output : process ID numbers in the form of a print statement.
+* Output : None
 *
-******************************************************************/
-void checkParents(){
+**************************************************/
+void resumeScriptOffset(){
 
-	if (backgrFlag == true){
-		processArrBG[overallProcessCount] = forkProcess;
-		overallProcessCount++;
-		waitpid(forkProcess, &exitTheChild, WNOHANG);
-		backgrFlag = false;
-		printf("\n");
-		printf(" background pid for the process : %d \n", forkProcess);
-		setExStatus = WEXITSTATUS(exitTheChild);
+	off_t resumeAt;
 
-		fflush(stdout);
-	}else if(backgrFlag == false){
-		//Make the parent wait.
-		waitpid(forkProcess, &exitTheChild, 0);
+	if (batchMode == true && batchMapped == true && scriptFd == 0){
+		resumeAt = lseek(0, 0, SEEK_CUR);
+		if (resumeAt >= 0){
+			batchPos = ((size_t)resumeAt < batchLen) ? (size_t)resumeAt : batchLen;
 		}
+	}
 }
 
-
-/*****************************************************************
-*
-* Function name : redirectionCms
+/*************************************************
+* Function name : initHistory
 *
+* Description :
+*	Opens the history file ($HISTFILE, or HISTORY_FILE in $HOME;
+*	an empty HISTFILE keeps history for the session only) for
+*	appending and maps what is already in it. Nothing is read or
+*	split into lines here : the pages come in when an entry is
+*	first looked at, and the line index only when a number is
+*	needed (indexHistory), so a long history costs nothing at
+*	startup.
 *
-* Description   :
-*           This takes care of redirections when they are found
-*           in the input of our program. It searches for the appearance
-*			of either "<" or ">" and makes judgements on the validity
-*			of a file based on the redirection signal and or whether or
-*			not the program can open the specified file. Two do while
-*			loops are used in this to firstly gather our program's input
-*			into the checker array and then to run our checking processes
-*			over that array while there still are elements in that array
-*			to check.
-*
-*	Note : I followed a little bit of a tutorial to utilize strtok
-*		  correctly with this one.
-*
-* Inputs : None
-*
-* Outputs : Depending on the appearance of redirection symbols "<" ">"
-*			and depending on the validity of our file either we will get
-*			an error message if the validty of the file is questionable.
-*			DUP2 and execvp are called on valid files.
+* Input  : None
+* Output : histFd, histMap, histMapLen
 *
-******************************************************************/
-void redirectionCms(){
+**************************************************/
+void initHistory(){
 
-	//Comparison strings
-	const char inputChar[2]    = "<";
-    const char outputChar[2]   = ">";
-
-	char* cmdArg[MAXIMUM_NUM_ARGS];
-	int arrayCount, fname, i = 0;
-	bool redirectionFlag = false;
-	bool cmdArgcheck = false;
-	int track = 0;
-
-	//Retrieves commands from input
-	// Following example of :
-	// https://www.tutorialspoint.com/c_standard_library/c_function_strtok.htm
-	// for the usage of strtok here
-	cmdArg[0] = strtok(proginp, " ");
-
-	do {
-		arrayCount++;
-		cmdArg[arrayCount] = strtok(NULL, " ");
-		track = cmdArg[arrayCount];
-		cmdArgcheck = true;
-	}while(cmdArg[arrayCount] != NULL);
-    //Keep going as long as data exists
-	//Do while loop for this
-	do {
-		//Search for redirections
-		if (strEquals(cmdArg[i], inputChar) == true && open(cmdArg[i + 1], O_RDONLY, 0) < 0){
-			//Here we open the file utilizing read only.
-			fname = open(cmdArg[i + 1], O_RDONLY, 0);
-			//case where open file was unsuccessful
-			perror("Error : ");
-			printf("A bad file has been given to the program. ' %s ' cannot be opened. \n", cmdArg[i + 1]);	//Output error
-			fflush(stdout);
-			exit(1);
-		}else if (strEquals(cmdArg[i], inputChar) == true && open(cmdArg[i + 1], O_RDONLY, 0) > 0){
-			//Make file pointer point towards stdout
-			fname = open(cmdArg[i + 1], O_RDONLY, 0);
-			//Set redirect then dup2
-			redirectionFlag = true;	
-			runDUP(fname, 0, i, cmdArg);					
-		}
-		//Search for redirects in the case were the second clause
-		// of the above else if is not true.
-		else if (strEquals(cmdArg[i], outputChar) == true){
-			//Write only file made.
-			fname = open(cmdArg[i + 1], O_CREAT | O_WRONLY, 0755);
-			redirectionFlag = true;
-			//Set redirect then dup2
-			runDUP(fname, 1, i, cmdArg);
-		}
-
-		arrayCount = arrayCount - 1;
-		i = i + 1;
-		redirectionFlag = false;
-		
-	} while (arrayCount != 0);
+	const char* path = getenv("HISTFILE");
+	const char* home = getenv("HOME");
+	char*  built = NULL;
+	struct stat histInfo;
+	void*  mapped;
 
-	//If there is no redirection; execute and print an error statement.
-	if(execvp(cmdArg[0], cmdArg)){
-		perror("Error : ");
-		printf(" ' %s ' does not exist as a file or directory and cannot be found. \n", proginp);	//If error then ouput issue
-		fflush(stdout);
-		exit(1);
+	if (path == NULL){
+		if (home == NULL){
+			return;
+		}
+		built = malloc(strlen(home) + strlen(HISTORY_FILE) + 2);
+		sprintf(built, "%s/%s", home, HISTORY_FILE);
+		path = built;
+	}
+	if (path[0] != '\0'){
+		histFd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+	}
+	free(built);
+	if (histFd < 0){
+		return;
 	}
 
+	if (fstat(histFd, &histInfo) == 0 && S_ISREG(histInfo.st_mode) && histInfo.st_size > 0){
+		mapped = mmap(NULL, histInfo.st_size, PROT_READ, MAP_PRIVATE, histFd, 0);
+		if (mapped != MAP_FAILED){
+			histMap = mapped;
+			histMapLen = histInfo.st_size;
+		}
+		//A shell that died mid-line : end that line before adding ours.
+		if (histMap != NULL && histMap[histMapLen - 1] != '\n'){
+			write(histFd, "\n", 1);
+		}
+	}
 }
 
-/*****************************************************************
-*
-* Function name :
-*		runDUP
+/*************************************************
+* Function name : addHistory
 *
 * Description :
-*		runs dup2 and execvp on processes passed into it.
-*		it then utilizes fcntl to close the file.
+*	Records one interactive line (blank lines are skipped). The
+*	line and its newline go out in a single writev() on the
+*	O_APPEND descriptor, so shells sharing the file never tear
+*	each other's lines.
 *
-* Input : fname, (0 or 1 depending on the context), i, cmdArg
-*				 (0 = standard in), (1 = standard output)
-*       
-* Output : None.
+* Input  : line
+* Output : None
 *
-*****************************************************************/
+**************************************************/
+void addHistory(const char* line){
 
-void runDUP(int a, int b, int c, char* cArg[MAXIMUM_NUM_ARGS]){
+	struct iovec parts[2];
+	size_t lineLen = strlen(line);
 
-	dup2(a, b);
-	cArg[c] = 0;						
-	execvp(cArg[0], cArg);
-	fcntl(a, F_SETFD, FD_CLOEXEC);
-	
-}
+	if (strspn(line, " \t") == lineLen){
+		return;
+	}
+	if (histSessionCount == histSessionCap){
+		histSessionCap = (histSessionCap == 0) ? 64 : histSessionCap * 2;
+		histSession = realloc(histSession, histSessionCap * sizeof(char*));
+	}
+	histSession[histSessionCount++] = strdup(line);
 
+	if (histFd >= 0){
+		parts[0].iov_base = (void*)line;
+		parts[0].iov_len = lineLen;
+		parts[1].iov_base = "\n";
+		parts[1].iov_len = 1;
+		writev(histFd, parts, 2);
+	}
+}
 
-/*****************************************************************
+/*************************************************
+* Function name : expandHistory
 *
-* Function name : attachChildpid
+* Description :
+*	History recall on the line just typed, before it is lexed.
+*	A word starting with "!" is replaced by an earlier line :
+*	  !!      the previous line        !-N    the Nth one back
+*	  !N      line number N            !TEXT  the last line
+*	                                          starting with TEXT
+*	  !?TEXT? the last line containing TEXT
+*	A "!" followed by a blank, "=" or "(" is left alone, and so
+*	is one inside a word. Only the recalled line is copied out
+*	of the mapped file. When anything was replaced the new line
+*	is echoed, as in bash.
 *
+* Input  : None (proginp)
+* Output : false (after a message) if an event was not found.
 *
-* Description : 
-*	This function is used in the case where :
-*	if (numSignals > 0 && strstr(proginp, killstr) != NULL){
-		attachChildpid();
+**************************************************/
+bool expandHistory(){
+
+	size_t lineLen = strlen(proginp);
+	char*  line;
+	char*  out;
+	char*  numEnd;
+	const char* entry;
+	size_t entryLen;
+	size_t outLen = 0;
+	size_t outCap;
+	size_t copied = 0;
+	size_t pos;
+	size_t wordEnd;
+	size_t textEnd;
+	long   number;
+
+	if (memchr(proginp, '!', lineLen) == NULL){
+		return true;
 	}
-	
-*  Terminates. When the number of signals gets to be greater than zero
-*  and when the kill command is found in the stdin of our program's input
-*  we then gather the child's process id number and attach it to the
-*  process it belongs to.
+	line = proginp;
+	outCap = lineLen + 1;
+	out = malloc(outCap);
+
+	for (pos = 0; pos + 1 < lineLen; pos++){
+		if (line[pos] != '!' || (pos > 0 && line[pos - 1] != ' ' && line[pos - 1] != '\t') ||
+		    strchr(" \t=(", line[pos + 1]) != NULL){
+			continue;
+		}
+		if (line[pos + 1] == '!'){
+			entry = historyRecent(1, &entryLen);
+			wordEnd = pos + 2;
+		}else if (isdigit((unsigned char)line[pos + 1]) ||
+		          (line[pos + 1] == '-' && isdigit((unsigned char)line[pos + 2]))){
+			number = strtol(line + pos + 1, &numEnd, 10);
+			wordEnd = numEnd - line;
+			if (number < -INT_MAX || number > INT_MAX){
+				entry = NULL;
+			}else if (number < 0){
+				entry = historyRecent(-number, &entryLen);
+			}else{
+				entry = historyEntry(number, &entryLen);
+			}
+		}else{
+			textEnd = pos + 1 + (line[pos + 1] == '?');
+			textEnd += strcspn(line + textEnd, (line[pos + 1] == '?') ? "? \t" : " \t");
+			wordEnd = textEnd + (line[pos + 1] == '?' && line[textEnd] == '?');
+			if (line[pos + 1] == '?'){
+				entry = historyFind(line + pos + 2, textEnd - pos - 2, false, &entryLen);
+			}else{
+				entry = historyFind(line + pos + 1, textEnd - pos - 1, true, &entryLen);
+			}
+		}
+		if (entry == NULL){
+			fprintf(stderr, "%.*s : event not found\n", (int)(wordEnd - pos), line + pos);
+			free(out);
+			return false;
+		}
+
+		while (outLen + (pos - copied) + entryLen + 1 > outCap){
+			outCap *= 2;
+		}
+		out = realloc(out, outCap);
+		memcpy(out + outLen, line + copied, pos - copied);
+		outLen += pos - copied;
+		memcpy(out + outLen, entry, entryLen);
+		outLen += entryLen;
+		copied = wordEnd;
+		pos = wordEnd - 1;
+	}
+
+	if (copied == 0){
+		free(out);
+		return true;
+	}
+	while (outLen + (lineLen - copied) + 1 > outCap){
+		outCap *= 2;
+	}
+	out = realloc(out, outCap);
+	memcpy(out + outLen, line + copied, lineLen - copied);
+	outLen += lineLen - copied;
+	out[outLen] = '\0';
+
+	growLine(outLen + 1);
+	memcpy(proginp, out, outLen + 1);
+	free(out);
+	printf("%s\n", proginp);
+	fflush(stdout);
+	return true;
+}
+
+/*************************************************
+* Function name : indexHistory
+*
+* Description :
+*	Builds histLines, the offset of every line of the mapped
+*	history, with one memchr() pass. Only done the first time an
+*	entry number is asked for ("history", !N); recalling recent
+*	lines and searching never need it.
+*
+* Input  : None
+* Output : histLines, histMapCount
+*
+**************************************************/
+void indexHistory(){
+
+	size_t pos = 0;
+	size_t cap = 0;
+	char*  newline;
+
+	if (histMapCount >= 0){
+		return;
+	}
+	histMapCount = 0;
+	while (pos < histMapLen){
+		if ((size_t)histMapCount == cap){
+			cap = (cap == 0) ? 1024 : cap * 2;
+			histLines = realloc(histLines, cap * sizeof(size_t));
+		}
+		histLines[histMapCount++] = pos;
+		newline = memchr(histMap + pos, '\n', histMapLen - pos);
+		pos = (newline != NULL) ? (size_t)(newline - histMap) + 1 : histMapLen;
+	}
+}
+
+int historyTotal(){
+
+	indexHistory();
+	return histMapCount + histSessionCount;
+}
+
+/*************************************************
+* Function name : historyEntry / historyRecent / historyFind
+*
+* Description :
+*	Look up one history line. The lines of the mapped file come
+*	first (numbered from 1), then the ones typed this session.
+*	The result points into the map or histSession and is not
+*	'\0' terminated; its length goes to *len.
+*	  historyEntry  : line number N
+*	  historyRecent : the Nth line counting back from the newest
+*	  historyFind   : the newest line starting with (prefix) or
+*	                  containing text
+*	historyRecent and historyFind walk back from the end of the
+*	map with memrchr() (mapLineBefore) and stop at the first hit,
+*	so recalling a recent line only touches the file's last pages.
+*
+* Input  : number / back / text, textLen, prefix
+* Output : The line, NULL if there is none.
+*
+**************************************************/
+const char* historyEntry(int number, size_t* len){
+
+	size_t start;
+	size_t end;
+
+	indexHistory();
+	if (number < 1){
+		return NULL;
+	}
+	if (number <= histMapCount){
+		start = histLines[number - 1];
+		end = (number < histMapCount) ? histLines[number] : histMapLen;
+		if (end > start && histMap[end - 1] == '\n'){
+			end--;
+		}
+		*len = end - start;
+		return histMap + start;
+	}
+	number -= histMapCount;
+	if (number > histSessionCount){
+		return NULL;
+	}
+	*len = strlen(histSession[number - 1]);
+	return histSession[number - 1];
+}
+
+const char* historyRecent(int back, size_t* len){
+
+	const char* line;
+	ssize_t end = histMapLen;
+
+	if (back < 1){
+		return NULL;
+	}
+	if (back <= histSessionCount){
+		*len = strlen(histSession[histSessionCount - back]);
+		return histSession[histSessionCount - back];
+	}
+	back -= histSessionCount;
+	while ((line = mapLineBefore(&end, len)) != NULL){
+		if (--back == 0){
+			return line;
+		}
+	}
+	return NULL;
+}
+
+const char* historyFind(const char* text, size_t textLen, bool prefix, size_t* len){
+
+	const char* line;
+	ssize_t end = histMapLen;
+	int     i;
+
+	if (textLen == 0){
+		return NULL;
+	}
+	for (i = histSessionCount - 1; i >= 0; i--){
+		*len = strlen(histSession[i]);
+		if (historyMatch(histSession[i], *len, text, textLen, prefix) == true){
+			return histSession[i];
+		}
+	}
+	while ((line = mapLineBefore(&end, len)) != NULL){
+		if (historyMatch(line, *len, text, textLen, prefix) == true){
+			return line;
+		}
+	}
+	return NULL;
+}
+
+bool historyMatch(const char* line, size_t len, const char* text, size_t textLen, bool prefix){
+
+	if (prefix == true){
+		return len >= textLen && memcmp(line, text, textLen) == 0;
+	}
+	return memmem(line, len, text, textLen) != NULL;
+}
+
+/*************************************************
+* Function name : mapLineBefore
+*
+* Description :
+*	Steps backwards through the mapped history one line at a
+*	time. Start with *end = histMapLen; each call returns the
+*	line before *end and moves *end to just before it.
+*
+* Input  : end
+* Output : The line (length in *len), NULL at the top of the file.
+*
+**************************************************/
+const char* mapLineBefore(ssize_t* end, size_t* len){
+
+	char*  newline;
+	size_t start;
+
+	if (histMap == NULL || *end < 0){
+		return NULL;
+	}
+	if ((size_t)*end == histMapLen && histMap[histMapLen - 1] == '\n'){
+		(*end)--;
+	}
+	newline = memrchr(histMap, '\n', *end);
+	start = (newline != NULL) ? (size_t)(newline - histMap) + 1 : 0;
+	*len = *end - start;
+	*end = (ssize_t)start - 1;
+	return histMap + start;
+}
+
+/*****************************************************************
+ * Function name ; strEquals
+ * 
+ * Description:
+ * String comparison helper function
+ * This helps ensure and WRAP the strcmp function
+ * This also helps absolutely ensure that correct
+ * comparisons and judgements on those are being made.
+ * 
+ * Input : 
+ *  string1 and string2.
+ * 
+ * Output : 
+ *  Bool. (True or false). 
+ * 
+*****************************************************************/
+
+bool strEquals(const char* a, const char* b) {
+
+	return strcmp(a , b) == 0;
+}
+
+/*****************************************************************
+ * Function name : growLine
+ * 
+ * Description :
+ * Makes room for need bytes in proginp, doubling its size. The
+ * buffer is never shrunk or freed.
+ * 
+ * Input  : 
+ *  need
+ * 
+ * Output :
+ *  proginp, proginpCap
+ * 
+*****************************************************************/
+void growLine(size_t need){
+
+	size_t newCap = (proginpCap == 0) ? MAXIMUM_NUM_CHARACTERS : proginpCap;
+
+	if (need <= proginpCap){
+		return;
+	}
+	while (newCap < need){
+		newCap *= 2;
+	}
+	proginp = realloc(proginp, newCap);
+	proginpCap = newCap;
+}
+
+/*****************************************************************
+ * Function name : arenaAlloc
+ * 
+ * Description :
+ * Bump allocation from a chain of blocks. When no block has room
+ * a new one, twice the size of the last, is added to the end of
+ * the chain. Nothing is freed on its own; see arenaReset.
+ * 
+ * Input  : 
+ *  pool, size
+ * 
+ * Output :
+ *  size bytes, pointer aligned, valid until the next reset.
+ * 
+*****************************************************************/
+void* arenaAlloc(struct arena* pool, size_t size){
+
+	struct arenaBlock* block = pool->current;
+	size_t blockSize;
+
+	size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+	while (block != NULL && block->size - block->used < size){
+		block = block->next;
+	}
+	if (block == NULL){
+		blockSize = (pool->last == NULL) ? ARENA_BLOCK : pool->last->size * 2;
+		while (blockSize < size){
+			blockSize *= 2;
+		}
+		block = malloc(sizeof(struct arenaBlock) + blockSize);
+		block->next = NULL;
+		block->size = blockSize;
+		block->used = 0;
+		if (pool->last == NULL){
+			pool->first = block;
+		}else{
+			pool->last->next = block;
+		}
+		pool->last = block;
+	}
+	pool->current = block;
+	block->used += size;
+	return block->data + block->used - size;
+}
+
+/*****************************************************************
+ * Function name : arenaReset
+ * 
+ * Description :
+ * Gives back everything allocated from pool at once. The blocks
+ * are kept for the next line.
+ * 
+ * Input  : 
+ *  pool
+ * 
+ * Output :
+ *  None
+ * 
+*****************************************************************/
+void arenaReset(struct arena* pool){
+
+	struct arenaBlock* block;
+
+	for (block = pool->first; block != NULL; block = block->next){
+		block->used = 0;
+	}
+	pool->current = pool->first;
+}
+
+/*****************************************************************
+ * Function name : arenaSave / arenaRestore
+ * 
+ * Description :
+ * Remember how full an arena is, and later give back everything
+ * allocated since. Loops use this around each pass.
+ * 
+ * Input  : 
+ *  pool, mark
+ * 
+ * Output :
+ *  The mark / None
+ * 
+*****************************************************************/
+struct arenaMark arenaSave(struct arena* pool){
+
+	struct arenaMark mark;
+
+	mark.block = pool->current;
+	mark.used = (pool->current != NULL) ? pool->current->used : 0;
+	return mark;
+}
+
+void arenaRestore(struct arena* pool, struct arenaMark mark){
+
+	struct arenaBlock* block;
+
+	if (mark.block == NULL){
+		arenaReset(pool);
+		return;
+	}
+	mark.block->used = mark.used;
+	for (block = mark.block->next; block != NULL; block = block->next){
+		block->used = 0;
+	}
+	pool->current = mark.block;
+}
+
+/*****************************************************************
+ * Function name : lexLine
+ * 
+ * Description :
+ * Splits a line into lineTokens in a single pass. Words are left
+ * where they are : the space after each one is overwritten with
+ * '\0' and the token just points at it, so nothing is copied.
+ * While walking a word we also note whether it has a '$' in it,
+ * which is the marker parseLine() uses to decide if the word
+ * needs expanding at all. A "$(" keeps the word going, blanks
+ * included, up to its matching ")".
+ *
+ * ";", "&&" and "||" are operators wherever they appear, so
+ * "echo x > o; cat o" and "for i in 1 2; do" split the way they do
+ * in sh; a word cut short by one ends there and the operator token
+ * gets its own text (opText), as the line has no room left for it.
+ * The other operators (|, &, and redirections like <, >, >>, 2>&1)
+ * are only operators as whole words, as the syntax says. A "&" is the background marker only as the last
+ * word; anywhere else it is plain text. In foreground-only mode the
+ * marker is still removed but ignored.
+ *
+ * A line whose first word starts with "#" is a comment and gives
+ * no tokens. readIn() joins the lines of an unfinished construct
+ * with a lone "\n" word, which becomes TOK_NEWLINE.
+ * 
+ * Input  : 
+ *  line (modified in place)
+ * 
+ * Output :
+ *  lineTokens (grown as needed), numTokens, backgrFlag
+ * 
+*****************************************************************/
+void lexLine(char* line){
+
+	static char opText[3][3] = { ";", "&&", "||" };
+	char* cursor = line;
+	char* start;
+	int   flags;
+	int   type;
+	int   opType;
+	struct redirect scratch;
+
+	numTokens = 0;
+	while (true){
+		while (*cursor == ' ' || *cursor == '\t'){
+			cursor++;
+		}
+		if (*cursor == '\0'){
+			break;
+		}
+		//A comment runs to the end of its own line.
+		if (*cursor == '#' && (numTokens == 0 || lineTokens[numTokens - 1].type == TOK_NEWLINE)){
+			cursor += strcspn(cursor, "\n");
+			continue;
+		}
+
+		start = cursor;
+		flags = 0;
+		while (*cursor != '\0' && *cursor != ' ' && *cursor != '\t'){
+			if (*cursor == ';' || ((*cursor == '&' || *cursor == '|') && cursor[1] == *cursor)){
+				break;
+			}
+			if (*cursor == '*' || *cursor == '?' || *cursor == '['){
+				flags |= TOKF_GLOB;
+			}
+			if (*cursor == '$'){
+				flags |= TOKF_DOLLAR;
+				if (cursor[1] == '('){
+					flags |= TOKF_SUBST;
+					cursor = matchParen(cursor + 1);
+					if (*cursor == '\0'){
+						break;
+					}
+				}
+			}
+			cursor++;
+		}
+
+		//The word stopped at ";", "&&" or "||".
+		opType = TOK_WORD;
+		if (*cursor == ';'){
+			opType = TOK_SEMI;
+		}else if (*cursor == '&' || *cursor == '|'){
+			opType = (*cursor == '&') ? TOK_AND : TOK_OR;
+		}
+
+		if (cursor == start){
+			//The operator is all there is.
+			cursor++;
+		}else{
+			//Short words might be operators.
+			type = TOK_WORD;
+			if (cursor - start == 1){
+				switch (*start){
+					case '|' : type = TOK_PIPE; break;
+					case '&' : type = TOK_AMP;  break;
+					case '\n': type = TOK_NEWLINE; break;
+				}
+			}
+			if (*cursor != '\0'){
+				*cursor++ = '\0';
+			}
+			if (type == TOK_WORD && cursor - start <= 5 && flags == 0 &&
+			    parseRedirWord(start, &scratch) == true){
+				type = TOK_REDIR;
+			}
+			addToken(type, flags, start);
+		}
+		if (opType != TOK_WORD){
+			cursor += (opType != TOK_SEMI);
+			addToken(opType, 0, opText[(opType == TOK_SEMI) ? 0 : (opType == TOK_AND) ? 1 : 2]);
+		}
+	}
+
+	//Only a trailing & means background.
+	if (numTokens > 0 && lineTokens[numTokens - 1].type == TOK_AMP){
+		numTokens--;
+		if (TSTPflag == false){
+			backgrFlag = true;
+		}
+	}
+}
+
+//Appends one token to lineTokens, growing it as needed.
+void addToken(int type, int flags, char* text){
+
+	if (numTokens == tokenCap){
+		tokenCap = (tokenCap == 0) ? MAXIMUM_NUM_ARGS : tokenCap * 2;
+		lineTokens = realloc(lineTokens, tokenCap * sizeof(struct token));
+	}
+	lineTokens[numTokens].type = type;
+	lineTokens[numTokens].flags = flags;
+	lineTokens[numTokens].text = text;
+	numTokens++;
+}
+
+/*****************************************************************
+ * Function name : parseLine
+ * 
+ * Description :
+ * Turns lineTokens into lineTree with a small recursive descent
+ * parser :
+ *   list     : andOr { (";" | newline) andOr }
+ *   andOr    : command { ("&&" | "||") command }
+ *   command  : for | while | function | "{" list "}" | pipeline
+ *   for      : "for" NAME "in" word... (";" | newline) doGroup
+ *   while    : "while" list doGroup
+ *   doGroup  : "do" list "done"
+ *   function : "function" NAME ["()"] group | NAME "()" group
+ * && and || chain left to right and ";" joins the chains, so
+ * "a && b || c ; d" is SEQ(OR(AND(a, b), c), d).
+ *
+ * Only the shape of each pipeline is checked here (every "|" has a
+ * command on both sides, every file redirection has its file).
+ * Expansion and argv building wait for buildStages().
+ *
+ * The trailing "&", already taken off by lexLine(), is given to
+ * the last pipeline. lineArena is rewound here, and the nodes come
+ * from it.
+ * 
+ * Input  : 
+ *  None (lineTokens, backgrFlag)
+ * 
+ * Output :
+ *  lineTree (NULL for an empty line). false when the line is
+ *  malformed (after a message), or when it stops in the middle of
+ *  a construct (parseIncomplete, no message).
+ * 
+*****************************************************************/
+bool parseLine(){
+
+	struct cmdNode* tree;
+
+	arenaReset(&lineArena);
+	lineTree = NULL;
+	numStages = 0;
+	parsePos = 0;
+	parseFailed = false;
+	parseIncomplete = false;
+	lastPipeline = NULL;
+
+	tree = parseList();
+	//Anything left over is a keyword out of place ("done", "}").
+	if (parseFailed == false && parsePos < numTokens){
+		parseError(parsePos);
+	}
+	if (parseFailed == true){
+		backgrFlag = false;
+		return false;
+	}
+
+	if (lastPipeline != NULL){
+		lastPipeline->background = backgrFlag;
+	}
+	backgrFlag = false;
+	lineTree = tree;
+	execTokens = lineTokens;
+	return true;
+}
+
+/*****************************************************************
+ * Function name : parseList / parseAndOr / parseCommand
+ * 
+ * Description :
+ * The list levels of the grammar. parseList stops at the end of
+ * the tokens or at a word that closes a construct ("do", "done",
+ * "}"), leaving it for the caller. Line breaks may sit anywhere a
+ * ";" could, and after "&&" / "||".
+ * 
+ * Input  : 
+ *  None (parsePos)
+ * 
+ * Output :
+ *  The subtree, NULL for an empty list or after an error.
+ * 
+*****************************************************************/
+struct cmdNode* parseList(){
+
+	struct cmdNode* list = NULL;
+	struct cmdNode* item;
+
+	while (parseFailed == false){
+		while (parsePos < numTokens && lineTokens[parsePos].type == TOK_NEWLINE){
+			parsePos++;
+		}
+		if (parsePos >= numTokens || isTerminator(parsePos) == true){
+			break;
+		}
+		item = parseAndOr();
+		if (parseFailed == true){
+			break;
+		}
+		list = (list == NULL) ? item : newNode(NODE_SEQ, list, item);
+		if (parsePos < numTokens && (lineTokens[parsePos].type == TOK_SEMI ||
+		                             lineTokens[parsePos].type == TOK_NEWLINE)){
+			parsePos++;
+			continue;
+		}
+		break;
+	}
+	return list;
+}
+
+struct cmdNode* parseAndOr(){
+
+	struct cmdNode* item = parseCommand();
+	int op;
+
+	while (parseFailed == false && parsePos < numTokens &&
+	       (lineTokens[parsePos].type == TOK_AND || lineTokens[parsePos].type == TOK_OR)){
+		op = (lineTokens[parsePos].type == TOK_AND) ? NODE_AND : NODE_OR;
+		parsePos++;
+		while (parsePos < numTokens && lineTokens[parsePos].type == TOK_NEWLINE){
+			parsePos++;
+		}
+		item = newNode(op, item, parseCommand());
+	}
+	return item;
+}
+
+struct cmdNode* parseCommand(){
+
+	if (parsePos >= numTokens){
+		parseError(parsePos);
+		return NULL;
+	}
+	if (lineTokens[parsePos].type == TOK_WORD){
+		if (isWord(parsePos, "for") == true){
+			return parseFor();
+		}
+		if (isWord(parsePos, "while") == true){
+			return parseWhile();
+		}
+		if (isWord(parsePos, "function") == true || isWord(parsePos + 1, "()") == true){
+			return parseFunction();
+		}
+		if (isWord(parsePos, "{") == true){
+			return parseGroup();
+		}
+		if (isTerminator(parsePos) == true){
+			parseError(parsePos);
+			return NULL;
+		}
+	}
+	return parsePipeline();
+}
+
+/*****************************************************************
+ * Function name : parsePipeline
+ * 
+ * Description :
+ * One pipeline : everything up to the next ; && || or line break.
+ * Checks the pipes and redirections and records the token range.
+ * 
+ * Input  : 
+ *  None (parsePos)
+ * 
+ * Output :
+ *  A NODE_PIPELINE, or NULL after an error.
+ * 
+*****************************************************************/
+struct cmdNode* parsePipeline(){
+
+	struct cmdNode* pipeline;
+	struct redirect scratch;
+	int  start = parsePos;
+	bool stageHasWord = false;
+	bool sawPipe = false;
+
+	for (; parsePos < numTokens; parsePos++){
+		switch (lineTokens[parsePos].type){
+			case TOK_SEMI :
+			case TOK_AND :
+			case TOK_OR :
+			case TOK_NEWLINE :
+				break;
+			case TOK_REDIR :
+				parseRedirWord(lineTokens[parsePos].text, &scratch);
+				if (scratch.mode == REDIR_DUP || scratch.mode == REDIR_CLOSE){
+					continue;
+				}
+				if (parsePos + 1 >= numTokens || lineTokens[parsePos + 1].type != TOK_WORD){
+					printf("syntax error : missing file name after %s\n", lineTokens[parsePos].text);
+					fflush(stdout);
+					parseFailed = true;
+					return NULL;
+				}
+				parsePos++;
+				continue;
+			case TOK_PIPE :
+				if (stageHasWord == false){
+					printf("syntax error : empty command in pipeline\n");
+					fflush(stdout);
+					parseFailed = true;
+					return NULL;
+				}
+				stageHasWord = false;
+				sawPipe = true;
+				continue;
+			default :
+				stageHasWord = true;
+				continue;
+		}
+		break;
+	}
+
+	if (parsePos == start){
+		parseError(parsePos);
+		return NULL;
+	}
+	if (sawPipe == true && stageHasWord == false){
+		printf("syntax error : empty command in pipeline\n");
+		fflush(stdout);
+		parseFailed = true;
+		return NULL;
+	}
+	pipeline = newNode(NODE_PIPELINE, NULL, NULL);
+	pipeline->tokenStart = start;
+	pipeline->tokenEnd = parsePos;
+	lastPipeline = pipeline;
+	return pipeline;
+}
+
+/*****************************************************************
+ * Function name : parseFor / parseWhile / parseDoGroup
+ * 
+ * Description :
+ * "for NAME in word ... ; do LIST ; done" and
+ * "while LIST ; do LIST ; done".
+ * 
+ * Input  : 
+ *  None (parsePos at "for" / "while" / "do")
+ * 
+ * Output :
+ *  The loop node, or the body for parseDoGroup. NULL after an
+ *  error.
+ * 
+*****************************************************************/
+struct cmdNode* parseFor(){
+
+	struct cmdNode* loop = newNode(NODE_FOR, NULL, NULL);
+
+	parsePos++;
+	if (parsePos >= numTokens || lineTokens[parsePos].type != TOK_WORD ||
+	    isAssignment(lineTokens[parsePos].text) == true){
+		parseError(parsePos);
+		return NULL;
+	}
+	loop->tokenStart = parsePos++;
+	if (isWord(parsePos, "in") == false){
+		parseError(parsePos);
+		return NULL;
+	}
+	parsePos++;
+	while (parsePos < numTokens && lineTokens[parsePos].type == TOK_WORD){
+		parsePos++;
+	}
+	loop->tokenEnd = parsePos;
+	if (parsePos >= numTokens || (lineTokens[parsePos].type != TOK_SEMI &&
+	                              lineTokens[parsePos].type != TOK_NEWLINE)){
+		parseError(parsePos);
+		return NULL;
+	}
+	parsePos++;
+	loop->left = parseDoGroup();
+	return (parseFailed == true) ? NULL : loop;
+}
+
+struct cmdNode* parseWhile(){
+
+	struct cmdNode* loop = newNode(NODE_WHILE, NULL, NULL);
+
+	parsePos++;
+	loop->left = parseList();
+	if (parseFailed == true){
+		return NULL;
+	}
+	if (loop->left == NULL){
+		parseError(parsePos);
+		return NULL;
+	}
+	loop->right = parseDoGroup();
+	return (parseFailed == true) ? NULL : loop;
+}
+
+struct cmdNode* parseDoGroup(){
+
+	struct cmdNode* body;
+
+	while (parsePos < numTokens && lineTokens[parsePos].type == TOK_NEWLINE){
+		parsePos++;
+	}
+	if (isWord(parsePos, "do") == false){
+		parseError(parsePos);
+		return NULL;
+	}
+	parsePos++;
+	body = parseList();
+	if (parseFailed == true){
+		return NULL;
+	}
+	if (body == NULL || isWord(parsePos, "done") == false){
+		parseError(parsePos);
+		return NULL;
+	}
+	parsePos++;
+	return body;
+}
+
+/*****************************************************************
+ * Function name : parseFunction / parseGroup
+ * 
+ * Description :
+ * "function NAME { LIST ; }", "NAME () { LIST ; }" and a bare
+ * "{ LIST ; }". A group is just its list; there is no subshell.
+ * 
+ * Input  : 
+ *  None (parsePos at "function", NAME or "{")
+ * 
+ * Output :
+ *  A NODE_FUNCDEF, or the group's list. NULL after an error.
+ * 
+*****************************************************************/
+struct cmdNode* parseFunction(){
+
+	struct cmdNode* definition = newNode(NODE_FUNCDEF, NULL, NULL);
+
+	if (isWord(parsePos, "function") == true){
+		parsePos++;
+	}
+	if (parsePos >= numTokens || lineTokens[parsePos].type != TOK_WORD ||
+	    isTerminator(parsePos) == true || isAssignment(lineTokens[parsePos].text) == true){
+		parseError(parsePos);
+		return NULL;
+	}
+	definition->tokenStart = parsePos++;
+	if (isWord(parsePos, "()") == true){
+		parsePos++;
+	}
+	while (parsePos < numTokens && lineTokens[parsePos].type == TOK_NEWLINE){
+		parsePos++;
+	}
+	if (isWord(parsePos, "{") == false){
+		parseError(parsePos);
+		return NULL;
+	}
+	definition->left = parseGroup();
+	definition->tokenEnd = parsePos;
+	return (parseFailed == true) ? NULL : definition;
+}
+
+struct cmdNode* parseGroup(){
+
+	struct cmdNode* body;
+
+	parsePos++;
+	body = parseList();
+	if (parseFailed == true){
+		return NULL;
+	}
+	if (body == NULL || isWord(parsePos, "}") == false){
+		parseError(parsePos);
+		return NULL;
+	}
+	parsePos++;
+	return body;
+}
+
+/*****************************************************************
+ * Function name : parseError / isWord / isTerminator
+ * 
+ * Description :
+ * parseError reports an unexpected token, or, at the end of the
+ * tokens, just marks the line as incomplete so more is read.
+ * isWord tests for a given plain word at pos; isTerminator for
+ * one of the words that close a construct.
+ * 
+ * Input  : 
+ *  pos (word)
+ * 
+ * Output :
+ *  parseFailed, parseIncomplete / Bool
+ * 
+*****************************************************************/
+void parseError(int pos){
+
+	parseFailed = true;
+	if (pos >= numTokens){
+		parseIncomplete = true;
+		return;
+	}
+	printf("syntax error near '%s'\n",
+	       (lineTokens[pos].type == TOK_NEWLINE) ? "newline" : lineTokens[pos].text);
+	fflush(stdout);
+}
+
+bool isWord(int pos, const char* word){
+
+	return pos < numTokens && lineTokens[pos].type == TOK_WORD &&
+	       strEquals(lineTokens[pos].text, word) == true;
+}
+
+bool isTerminator(int pos){
+
+	return isWord(pos, "do") == true || isWord(pos, "done") == true || isWord(pos, "}") == true;
+}
+
+/*****************************************************************
+ * Function name : newNode
+ * 
+ * Description :
+ * One lineTree node from lineArena.
+ * 
+ * Input  : 
+ *  type, left, right
+ * 
+ * Output :
+ *  The node.
+ * 
+*****************************************************************/
+struct cmdNode* newNode(int type, struct cmdNode* left, struct cmdNode* right){
+
+	struct cmdNode* node = arenaAlloc(&lineArena, sizeof(struct cmdNode));
+
+	node->type = type;
+	node->left = left;
+	node->right = right;
+	node->tokenStart = 0;
+	node->tokenEnd = 0;
+	node->background = false;
+	return node;
+}
+
+/*****************************************************************
+ * Function name : buildStages
+ * 
+ * Description :
+ * Turns the tokens of one pipeline node into lineStages. Word
+ * tokens become arguments of the current stage, redirections are
+ * decoded into lineRedirs (the ones that name a file take the next
+ * word) and "|" starts a new stage. Words carrying the '$' marker
+ * go through expandWord(); every other word is used as is. An
+ * argument that expands to nothing is left out, one with a $(...)
+ * in it is split into fields, and a pathname pattern is replaced by
+ * the names it matches (expandGlob).
+ *
+ * The arrays come from lineArena. Each token is at most one
+ * argument, redirection or stage, so one more than the number of
+ * tokens of each is enough until a $(...) or a pattern turns into
+ * more; then lineArgs is moved to a bigger block (growArgs).
+ * 
+ * Input  : 
+ *  node
+ * 
+ * Output :
+ *  lineStages, numStages, cmdTokenStart/End. false (after a
+ *  message) if a stage of a pipeline expanded to nothing.
+ * 
+*****************************************************************/
+bool buildStages(struct cmdNode* node){
+
+	struct pipeStage* stage;
+	struct redirect*  redir;
+	int    count = node->tokenEnd - node->tokenStart;
+	int    argCount = 0;
+	int    argCap = count + 1;
+	int    redirCount = 0;
+	int    fields;
+	int    i;
+	char*  text;
+
+	numStages = 0;
+	cmdTokenStart = node->tokenStart;
+	cmdTokenEnd = node->tokenEnd;
+	lineStages = arenaAlloc(&lineArena, (count + 1) * sizeof(struct pipeStage));
+	lineArgs = arenaAlloc(&lineArena, (count + 1) * sizeof(char*));
+	lineRedirs = arenaAlloc(&lineArena, (count + 1) * sizeof(struct redirect));
+	stage = &lineStages[0];
+	stage->args = lineArgs;
+	stage->redirs = lineRedirs;
+	stage->numRedirs = 0;
+	for (i = node->tokenStart; i < node->tokenEnd; i++){
+		text = execTokens[i].text;
+		if (execTokens[i].flags & TOKF_DOLLAR){
+			text = expandWord(text);
+		}
+		switch (execTokens[i].type){
+			case TOK_REDIR :
+				redir = &lineRedirs[redirCount++];
+				parseRedirWord(text, redir);
+				stage->numRedirs++;
+				if (redir->mode == REDIR_DUP || redir->mode == REDIR_CLOSE){
+					break;
+				}
+				i++;
+				redir->target = execTokens[i].text;
+				if (execTokens[i].flags & TOKF_DOLLAR){
+					redir->target = expandWord(redir->target);
+				}
+				break;
+			case TOK_PIPE :
+				lineArgs[argCount++] = NULL;
+				if (stage->args[0] == NULL){
+					printf("empty command in pipeline\n");
+					fflush(stdout);
+					return false;
+				}
+				stage = &lineStages[++numStages];
+				stage->args = &lineArgs[argCount];
+				stage->redirs = &lineRedirs[redirCount];
+				stage->numRedirs = 0;
+				break;
+			default :
+				if (execTokens[i].flags & TOKF_SUBST){
+					//Room for the fields and one slot per token still to come.
+					fields = countFields(text);
+					growArgs(argCount, fields + (node->tokenEnd - i), &argCap);
+					argCount += splitFields(text, &lineArgs[argCount]);
+				}else if ((execTokens[i].flags & (TOKF_GLOB | TOKF_DOLLAR)) && isPattern(text) == true &&
+				          (fields = expandGlob(text)) > 0){
+					growArgs(argCount, fields + (node->tokenEnd - i), &argCap);
+					memcpy(&lineArgs[argCount], globMatches, fields * sizeof(char*));
+					argCount += fields;
+				}else if (text[0] != '\0' || (execTokens[i].flags & TOKF_DOLLAR) == 0){
+					lineArgs[argCount++] = text;
+				}
+				break;
+		}
+	}
+	lineArgs[argCount] = NULL;
+	numStages++;
+
+	if (stage->args[0] == NULL){
+		//"< file" on its own is allowed and does nothing.
+		if (numStages == 1){
+			numStages = 0;
+			return true;
+		}
+		printf("empty command in pipeline\n");
+		fflush(stdout);
+		return false;
+	}
+	return true;
+}
+
+/*****************************************************************
+ * Function name : runCommandList
+ * 
+ * Description :
+ * Runs lineTree (or a function body). Pipelines are built and
+ * handed to bCMDs() one at a time; && and || look at lastStatus of
+ * their left side to decide whether the right side runs. Nothing
+ * more runs once "exit" has been seen, or while a break, continue
+ * or return is on its way out.
+ * 
+ * Input  : 
+ *  node
+ * 
+ * Output :
+ *  lastStatus, exitTheChild (through bCMDs)
+ * 
+*****************************************************************/
+void runCommandList(struct cmdNode* node){
+
+	if (node == NULL || backgroundFlag == false || loopControl != LOOP_NONE){
+		return;
+	}
+	switch (node->type){
+		case NODE_PIPELINE :
+			if (buildStages(node) == false){
+				lastStatus = 2;
+				return;
+			}
+			backgrFlag = node->background;
+			bCMDs();
+			break;
+		case NODE_SEQ :
+			runCommandList(node->left);
+			runCommandList(node->right);
+			break;
+		case NODE_AND :
+			runCommandList(node->left);
+			if (lastStatus == 0){
+				runCommandList(node->right);
+			}
+			break;
+		case NODE_OR :
+			runCommandList(node->left);
+			if (lastStatus != 0){
+				runCommandList(node->right);
+			}
+			break;
+		case NODE_FOR :
+			runFor(node);
+			break;
+		case NODE_WHILE :
+			runWhile(node);
+			break;
+		case NODE_FUNCDEF :
+			defineFunction(node);
+			lastStatus = 0;
+			break;
+	}
+}
+
+/*****************************************************************
+ * Function name : runFor / runWhile
+ * 
+ * Description :
+ * The loops. The word list of a for loop is expanded once, before
+ * the first pass ($(...) words split into one item per field,
+ * patterns into the names they match). Every pass re-runs the body straight from the
+ * tree, and whatever the pass took from lineArena is given back
+ * at the end of it, so a loop of any length runs in the same
+ * memory. Nothing here starts a process; only external commands
+ * in the body do.
+ *
+ * The exit code is that of the last body command run, 0 if the
+ * body never ran.
+ * 
+ * Input  : 
+ *  node
+ * 
+ * Output :
+ *  lastStatus
+ * 
+*****************************************************************/
+void runFor(struct cmdNode* node){
+
+	struct arenaMark mark;
+	const char* name = execTokens[node->tokenStart].text;
+	struct token* word;
+	char** words;
+	char** moved;
+	char*  text;
+	int    count = node->tokenEnd - node->tokenStart - 2;
+	int    wordCap = count + 1;
+	int    numWords = 0;
+	int    fields;
+	int    bodyStatus = 0;
+	int    i;
+
+	words = arenaAlloc(&lineArena, wordCap * sizeof(char*));
+	for (i = 0; i < count; i++){
+		word = &execTokens[node->tokenStart + 2 + i];
+		text = word->text;
+		if (word->flags & TOKF_DOLLAR){
+			text = expandWord(text);
+		}
+		if (word->flags & TOKF_SUBST){
+			fields = countFields(text);
+		}else if ((word->flags & (TOKF_GLOB | TOKF_DOLLAR)) && isPattern(text) == true){
+			fields = expandGlob(text);
+		}else{
+			fields = 0;
+		}
+		if (fields == 0 && (word->flags & TOKF_SUBST) == 0){
+			words[numWords++] = text;
+			continue;
+		}
+		if (numWords + fields + (count - i) > wordCap){
+			wordCap = (numWords + fields + (count - i)) * 2;
+			moved = arenaAlloc(&lineArena, wordCap * sizeof(char*));
+			memcpy(moved, words, numWords * sizeof(char*));
+			words = moved;
+		}
+		if (word->flags & TOKF_SUBST){
+			numWords += splitFields(text, &words[numWords]);
+		}else{
+			memcpy(&words[numWords], globMatches, fields * sizeof(char*));
+			numWords += fields;
+		}
+	}
+	count = numWords;
+
+	loopDepth++;
+	for (i = 0; i < count; i++){
+		setVar(name, words[i]);
+		mark = arenaSave(&lineArena);
+		runCommandList(node->left);
+		arenaRestore(&lineArena, mark);
+		bodyStatus = lastStatus;
+		if (loopShouldStop() == true){
+			break;
+		}
+	}
+	loopDepth--;
+	lastStatus = bodyStatus;
+}
+
+void runWhile(struct cmdNode* node){
+
+	struct arenaMark mark;
+	int  bodyStatus = 0;
+	bool conditionMet;
+
+	loopDepth++;
+	while (true){
+		mark = arenaSave(&lineArena);
+		runCommandList(node->left);
+		conditionMet = (lastStatus == 0 && loopControl == LOOP_NONE);
+		if (conditionMet == true){
+			runCommandList(node->right);
+			bodyStatus = lastStatus;
+		}
+		arenaRestore(&lineArena, mark);
+		if (conditionMet == false && loopControl == LOOP_NONE){
+			break;
+		}
+		if (loopShouldStop() == true){
+			break;
+		}
+	}
+	loopDepth--;
+	lastStatus = bodyStatus;
+}
+
+/*****************************************************************
+ * Function name : loopShouldStop
+ * 
+ * Description :
+ * Called by a loop after each pass. Handles a pending break or
+ * continue (one level at a time for "break N"), lets a return go
+ * through, and stops after "exit" or when a command was killed by
+ * ^C (lineInterrupted, from the wait status) so a runaway loop can
+ * be interrupted.
+ * 
+ * Input  : 
+ *  None (loopControl, loopLevels)
+ * 
+ * Output :
+ *  true if this loop is done.
+ * 
+*****************************************************************/
+bool loopShouldStop(){
+
+	if (backgroundFlag == false || lineInterrupted == true){
+		return true;
+	}
+	if (loopControl == LOOP_NONE){
+		return false;
+	}
+	if (loopControl == LOOP_RETURN){
+		return true;
+	}
+	//"break 2" / "continue 2" : this loop stops, the next one out
+	// sees the rest.
+	if (--loopLevels > 0){
+		return true;
+	}
+	if (loopControl == LOOP_BREAK){
+		loopControl = LOOP_NONE;
+		return true;
+	}
+	loopControl = LOOP_NONE;
+	return false;
+}
+
+/*****************************************************************
+ * Function name : exitCode
+ * 
+ * Description :
+ * Converts a wait status to a shell exit code : the exit value,
+ * or 128 + the signal number for a killed process.
+ * 
+ * Input  : 
+ *  status
+ * 
+ * Output :
+ *  0-255
+ * 
+*****************************************************************/
+int exitCode(int status){
+
+	return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}
+
+/*****************************************************************
+ * Function name : findFunction / defineFunction
+ * 
+ * Description :
+ * Functions live in functionTable. Defining one copies the tokens
+ * of its definition (text included) and the parsed body out of
+ * the line, shifting the body's token numbers to the copy, so the
+ * body is never lexed or parsed again. Redefining a function
+ * replaces it; the old copy is kept if it is running right now.
+ * 
+ * Input  : 
+ *  name / node (NODE_FUNCDEF, tokens in execTokens)
+ * 
+ * Output :
+ *  The function or NULL / None
+ * 
+*****************************************************************/
+struct function* findFunction(const char* name){
+
+	struct function* fn;
+
+	for (fn = functionTable[hashName(name)]; fn != NULL; fn = fn->next){
+		if (strEquals(fn->name, name) == true){
+			return fn;
+		}
+	}
+	return NULL;
+}
+
+void defineFunction(struct cmdNode* node){
+
+	struct function* fn = findFunction(execTokens[node->tokenStart].text);
+	int    count = node->tokenEnd - node->tokenStart;
+	size_t textLen = 0;
+	size_t wordLen;
+	char*  text;
+	int    i;
+
+	if (fn == NULL){
+		fn = calloc(1, sizeof(struct function));
+		i = hashName(execTokens[node->tokenStart].text);
+		fn->next = functionTable[i];
+		functionTable[i] = fn;
+	}else if (fn->running == 0){
+		free(fn->tokens);
+		free(fn->text);
+		freeTree(fn->body);
+	}
+
+	for (i = 0; i < count; i++){
+		textLen += strlen(execTokens[node->tokenStart + i].text) + 1;
+	}
+	fn->text = malloc(textLen);
+	fn->tokens = malloc(count * sizeof(struct token));
+	text = fn->text;
+	for (i = 0; i < count; i++){
+		fn->tokens[i] = execTokens[node->tokenStart + i];
+		wordLen = strlen(fn->tokens[i].text) + 1;
+		memcpy(text, fn->tokens[i].text, wordLen);
+		fn->tokens[i].text = text;
+		text += wordLen;
+	}
+	fn->name = fn->tokens[0].text;
+	fn->body = copyTree(node->left, node->tokenStart);
+	fn->running = 0;
+}
+
+/*****************************************************************
+ * Function name : copyTree / freeTree
+ * 
+ * Description :
+ * Heap copy of a subtree with its token numbers moved down by
+ * shift, and its disposal.
+ * 
+ * Input  : 
+ *  node, shift
+ * 
+ * Output :
+ *  The copy / None
+ * 
+*****************************************************************/
+struct cmdNode* copyTree(struct cmdNode* node, int shift){
+
+	struct cmdNode* copy;
+
+	if (node == NULL){
+		return NULL;
+	}
+	copy = malloc(sizeof(struct cmdNode));
+	*copy = *node;
+	copy->tokenStart -= shift;
+	copy->tokenEnd -= shift;
+	copy->left = copyTree(node->left, shift);
+	copy->right = copyTree(node->right, shift);
+	return copy;
+}
+
+void freeTree(struct cmdNode* node){
+
+	if (node != NULL){
+		freeTree(node->left);
+		freeTree(node->right);
+		free(node);
+	}
+}
+
+/*****************************************************************
+ * Function name : callFunction
+ * 
+ * Description :
+ * Runs calledFunction's body with args[1...] as $1-$9 / $#. The
+ * body's tree points at the function's own tokens, so execTokens
+ * is switched for the duration. Loops of the caller are not
+ * visible inside (break there is an error), and a "return" stops
+ * here.
+ * 
+ * Input  : 
+ *  args (the call)
+ * 
+ * Output :
+ *  Exit code of the body, or of "return N".
+ * 
+*****************************************************************/
+int callFunction(char* args[]){
+
+	struct function* fn = calledFunction;
+	struct token* savedTokens = execTokens;
+	char** savedArgs = posArgs;
+	int    savedCount = posCount;
+	int    savedLoopDepth = loopDepth;
+
+	if (functionDepth >= MAXIMUM_FUNCTION_DEPTH){
+		printf("%s : maximum function nesting (%d) reached\n", args[0], MAXIMUM_FUNCTION_DEPTH);
+		fflush(stdout);
+		return 1;
+	}
+
+	posArgs = args + 1;
+	for (posCount = 0; posArgs[posCount] != NULL; posCount++){
+	}
+	execTokens = fn->tokens;
+	loopDepth = 0;
+	fn->running++;
+	functionDepth++;
+	lastStatus = 0;
+
+	runCommandList(fn->body);
+	if (loopControl == LOOP_RETURN){
+		loopControl = LOOP_NONE;
+	}
+
+	functionDepth--;
+	fn->running--;
+	loopDepth = savedLoopDepth;
+	execTokens = savedTokens;
+	posArgs = savedArgs;
+	posCount = savedCount;
+	return lastStatus;
+}
+
+/*****************************************************************
+ * Function name : isAssignment / assignVars
+ * 
+ * Description :
+ * NAME=value words. A command made only of them sets each one
+ * with setVar(); anything else on the line means it is not an
+ * assignment command at all.
+ * 
+ * Input  : 
+ *  word / args
+ * 
+ * Output :
+ *  Bool
+ * 
+*****************************************************************/
+bool isAssignment(const char* word){
+
+	const char* cursor = word;
+
+	if (*cursor != '_' && isalpha((unsigned char)*cursor) == 0){
+		return false;
+	}
+	while (*cursor == '_' || isalnum((unsigned char)*cursor)){
+		cursor++;
+	}
+	return *cursor == '=';
+}
+
+bool assignVars(char* args[]){
+
+	char* equals;
+	int   i;
+
+	for (i = 0; args[i] != NULL; i++){
+		if (isAssignment(args[i]) == false){
+			return false;
+		}
+	}
+	for (i = 0; args[i] != NULL; i++){
+		//Split at the '=' just long enough to store the pair.
+		equals = strchr(args[i], '=');
+		*equals = '\0';
+		setVar(args[i], equals + 1);
+		*equals = '=';
+	}
+	return true;
+}
+
+/*****************************************************************
+ * Function name : setVar / lookupVar
+ * 
+ * Description :
+ * Shell variables. A name that is already in the environment is
+ * updated there (it stays exported); anything else is kept in
+ * shellVars only. A variable's value buffer is reused when the
+ * new value fits, so a loop variable stops allocating after the
+ * first few passes. lookupVar checks shellVars first, then the
+ * environment.
+ * 
+ * Input  : 
+ *  name, value
+ * 
+ * Output :
+ *  None / the value or NULL
+ * 
+*****************************************************************/
+void setVar(const char* name, const char* value){
+
+	struct shellVar* var;
+	size_t valueLen = strlen(value) + 1;
+	unsigned int bucket = hashName(name);
+
+	for (var = shellVars[bucket]; var != NULL; var = var->next){
+		if (strEquals(var->name, name) == true){
+			break;
+		}
+	}
+	if (var == NULL){
+		if (getenv(name) != NULL){
+			setenv(name, value, 1);
+			return;
+		}
+		var = calloc(1, sizeof(struct shellVar));
+		var->name = strdup(name);
+		var->next = shellVars[bucket];
+		shellVars[bucket] = var;
+	}
+	if (valueLen > var->valueCap){
+		var->valueCap = (valueLen < STRING_BUFFER) ? STRING_BUFFER : valueLen;
+		var->value = realloc(var->value, var->valueCap);
+	}
+	memcpy(var->value, value, valueLen);
+}
+
+char* lookupVar(const char* name){
+
+	struct shellVar* var;
+
+	for (var = shellVars[hashName(name)]; var != NULL; var = var->next){
+		if (strEquals(var->name, name) == true){
+			return var->value;
+		}
+	}
+	return getenv(name);
+}
+
+/*****************************************************************
+ * Function name : parseRedirWord
+ * 
+ * Description :
+ * Decodes a redirection operator word :
+ *   [N]<  [N]>  [N]>>      file follows as the next word
+ *   [N]>&M  [N]<&M         N becomes a copy of M
+ *   [N]>&-  [N]<&-         N is closed
+ * N defaults to 0 for "<" and 1 for ">". N and M are one digit.
+ * 
+ * Input  : 
+ *  word
+ * 
+ * Output :
+ *  true and redir filled in if word is a redirection
+ * 
+*****************************************************************/
+bool parseRedirWord(const char* word, struct redirect* redir){
+
+	const char* cursor = word;
+
+	redir->fd = -1;
+	redir->source = -1;
+	redir->target = NULL;
+	redir->openFd = -1;
+	if (*cursor >= '0' && *cursor <= '9'){
+		redir->fd = *cursor++ - '0';
+	}
+	if (*cursor == '<'){
+		redir->mode = REDIR_IN;
+		redir->fd = (redir->fd < 0) ? 0 : redir->fd;
+	}else if (*cursor == '>'){
+		redir->mode = (cursor[1] == '>') ? REDIR_APPEND : REDIR_OUT;
+		redir->fd = (redir->fd < 0) ? 1 : redir->fd;
+		cursor += (redir->mode == REDIR_APPEND);
+	}else{
+		return false;
+	}
+	cursor++;
+
+	if (*cursor == '&' && redir->mode != REDIR_APPEND){
+		cursor++;
+		if (*cursor == '-'){
+			redir->mode = REDIR_CLOSE;
+		}else if (*cursor >= '0' && *cursor <= '9'){
+			redir->mode = REDIR_DUP;
+			redir->source = *cursor - '0';
+		}else{
+			return false;
+		}
+		cursor++;
+	}
+	return *cursor == '\0';
+}
+
+/*****************************************************************
+ * Function name : expandWord
+ * 
+ * Description :
+ * Expands, in one scan of the word :
+ *   $$       our pid (smallShellpidString, made once at startup)
+ *   $?       exit code of the last command
+ *   $!       pid of the last background command
+ *   $VAR     shell variable, else environment variable, up to
+ *            the first character that can not be in a name
+ *   ${VAR}   the same, delimited
+ *   $1-$9 $# arguments of the function being run, $0 "smallsh"
+ *   $(cmd)   the output of cmd, see commandSubst()
+ * Unset variables expand to nothing. A "$" that starts none of
+ * these is kept as it is.
+ *
+ * The result is built in expandScratch and copied into lineArena
+ * once, at its final size. Only called for words the lexer
+ * marked, so ordinary words are never copied.
+ * 
+ * Input  : 
+ *  word
+ * 
+ * Output :
+ *  The expanded word.
+ * 
+*****************************************************************/
+char* expandWord(char* word){
+
+	char   number[STRING_BUFFER];
+	size_t outLen = 0;
+	size_t nameLen;
+	char*  cursor = word;
+	char*  name;
+	char*  value;
+	char*  out;
+	char   saved;
+
+	while (*cursor != '\0'){
+		if (*cursor != '$'){
+			//Copy the run up to the next '$' in one go.
+			nameLen = strcspn(cursor, "$");
+			expandAppend(&outLen, cursor, nameLen);
+			cursor += nameLen;
+			continue;
+		}
+
+		cursor++;
+		if (*cursor == '$'){
+			expandAppend(&outLen, smallShellpidString, smallShellpidLen);
+			cursor++;
+		}else if (*cursor == '?'){
+			expandAppend(&outLen, number, snprintf(number, sizeof(number), "%d", lastStatus));
+			cursor++;
+		}else if (*cursor >= '1' && *cursor <= '9'){
+			if (*cursor - '0' <= posCount){
+				value = posArgs[*cursor - '1'];
+				expandAppend(&outLen, value, strlen(value));
+			}
+			cursor++;
+		}else if (*cursor == '0'){
+			expandAppend(&outLen, "smallsh", 7);
+			cursor++;
+		}else if (*cursor == '#'){
+			expandAppend(&outLen, number, snprintf(number, sizeof(number), "%d", posCount));
+			cursor++;
+		}else if (*cursor == '!'){
+			if (lastBackground > 0){
+				expandAppend(&outLen, number, snprintf(number, sizeof(number), "%d", lastBackground));
+			}
+			cursor++;
+		}else if (*cursor == '(' && *(value = matchParen(cursor)) == ')'){
+			name = cursor + 1;
+			cursor = value + 1;
+			value = commandSubst(name, cursor - name - 1, &nameLen);
+			expandAppend(&outLen, value, nameLen);
+		}else if (*cursor == '{' && (value = strchr(cursor, '}')) != NULL && value > cursor + 1){
+			name = cursor + 1;
+			cursor = value + 1;
+			*value = '\0';
+			value = lookupVar(name);
+			cursor[-1] = '}';
+			if (value != NULL){
+				expandAppend(&outLen, value, strlen(value));
+			}
+		}else if (*cursor == '_' || isalpha((unsigned char)*cursor)){
+			name = cursor;
+			while (*cursor == '_' || isalnum((unsigned char)*cursor)){
+				cursor++;
+			}
+			//Terminate the name in place just long enough to look it up.
+			saved = *cursor;
+			*cursor = '\0';
+			value = lookupVar(name);
+			*cursor = saved;
+			if (value != NULL){
+				expandAppend(&outLen, value, strlen(value));
+			}
+		}else{
+			expandAppend(&outLen, "$", 1);
+		}
+	}
+
+	out = arenaAlloc(&lineArena, outLen + 1);
+	memcpy(out, expandScratch, outLen);
+	out[outLen] = '\0';
+	return out;
+}
+
+/*****************************************************************
+ * Function name : expandAppend
+ * 
+ * Description :
+ * Adds text to expandScratch, doubling it when it is full.
+ * 
+ * Input  : 
+ *  outLen (bytes used so far), text, textLen
+ * 
+ * Output :
+ *  expandScratch, outLen
+ * 
+*****************************************************************/
+void expandAppend(size_t* outLen, const char* text, size_t textLen){
+
+	size_t newCap = (expandScratchCap == 0) ? STRING_BUFFER : expandScratchCap;
+
+	if (*outLen + textLen + 1 > expandScratchCap){
+		while (newCap < *outLen + textLen + 1){
+			newCap *= 2;
+		}
+		expandScratch = realloc(expandScratch, newCap);
+		expandScratchCap = newCap;
+	}
+	memcpy(expandScratch + *outLen, text, textLen);
+	*outLen += textLen;
+}
+
+/*****************************************************************
+ * Function name : matchParen
+ * 
+ * Description :
+ * Finds the ")" that closes the "(" at open, counting the ones
+ * nested inside.
+ * 
+ * Input  : 
+ *  open (points at a '(')
+ * 
+ * Output :
+ *  The closing ')', or the end of the string if there is none.
+ * 
+*****************************************************************/
+char* matchParen(char* open){
+
+	char* cursor = open + 1;
+	int   depth = 1;
+
+	while (*cursor != '\0'){
+		if (*cursor == '('){
+			depth++;
+		}else if (*cursor == ')' && --depth == 0){
+			break;
+		}
+		cursor++;
+	}
+	return cursor;
+}
+
+/*****************************************************************
+ * Function name : commandSubst
+ * 
+ * Description :
+ * Runs the command list inside a $(...) and returns what it
+ * printed, trailing newlines removed. The text is lexed and
+ * parsed on its own, then run by the same runCommandList() as any
+ * line, so externals still go through progFork().
+ *
+ * This happens in the middle of buildStages() for the outer
+ * command, so every global the inner run overwrites (tokens,
+ * stages, the expansion scratch) is put aside first and put back
+ * afterwards. Whatever the outer command already took from
+ * lineArena stays where it is.
+ *
+ * When substInShell() says the commands can not change the shell,
+ * they run right here with stdout on a memfd; otherwise in a fork
+ * of the shell, as sh does.
+ * 
+ * Input  : 
+ *  text, textLen (between the parentheses)
+ * 
+ * Output :
+ *  The output (in lineArena), outLen. lastStatus is the inner
+ *  command's.
+ * 
+*****************************************************************/
+char* commandSubst(char* text, size_t textLen, size_t* outLen){
+
+	struct token*     savedTokens = lineTokens;
+	struct token*     savedExec = execTokens;
+	struct pipeStage* savedStages = lineStages;
+	struct redirect*  savedRedirs = lineRedirs;
+	char**  savedArgs = lineArgs;
+	char*   savedScratch = expandScratch;
+	size_t  savedScratchCap = expandScratchCap;
+	int     savedNumTokens = numTokens;
+	int     savedTokenCap = tokenCap;
+	int     savedNumStages = numStages;
+	int     savedStart = cmdTokenStart;
+	int     savedEnd = cmdTokenEnd;
+	bool    savedBackgr = backgrFlag;
+	struct cmdNode* tree;
+	char*   copy = arenaAlloc(&lineArena, textLen + 1);
+	char*   out = "";
+
+	*outLen = 0;
+	memcpy(copy, text, textLen);
+	copy[textLen] = '\0';
+	lineTokens = NULL;
+	tokenCap = 0;
+	expandScratch = NULL;
+	expandScratchCap = 0;
+	backgrFlag = false;
+
+	lexLine(copy);
+	parsePos = 0;
+	parseFailed = false;
+	parseIncomplete = false;
+	lastPipeline = NULL;
+	tree = parseList();
+	if (parseFailed == false && parsePos < numTokens){
+		parseError(parsePos);
+	}
+	if (parseFailed == true){
+		if (parseIncomplete == true){
+			printf("syntax error : unexpected end of $(...)\n");
+			fflush(stdout);
+		}
+		lastStatus = 2;
+	}else{
+		if (lastPipeline != NULL){
+			lastPipeline->background = backgrFlag;
+		}
+		execTokens = lineTokens;
+		if (substInShell(tree) == true){
+			out = captureInShell(tree, outLen);
+		}else{
+			out = captureInChild(tree, outLen);
+		}
+		while (*outLen > 0 && out[*outLen - 1] == '\n'){
+			(*outLen)--;
+		}
+	}
+
+	free(lineTokens);
+	free(expandScratch);
+	lineTokens = savedTokens;
+	execTokens = savedExec;
+	lineStages = savedStages;
+	lineRedirs = savedRedirs;
+	lineArgs = savedArgs;
+	expandScratch = savedScratch;
+	expandScratchCap = savedScratchCap;
+	numTokens = savedNumTokens;
+	tokenCap = savedTokenCap;
+	numStages = savedNumStages;
+	cmdTokenStart = savedStart;
+	cmdTokenEnd = savedEnd;
+	backgrFlag = savedBackgr;
+	return out;
+}
+
+/*****************************************************************
+ * Function name : substInShell
+ * 
+ * Description :
+ * Whether a $(...) can run without a fork : every pipeline must
+ * either start an external command (those are children anyway)
+ * or be a builtin that only prints - echo, printf, pwd, test / [,
+ * true, false, :. Anything else (cd, exit, assignments, function
+ * calls, loops, background jobs, a command name that is itself
+ * expanded) could change the shell, so the answer is no.
+ * 
+ * Input  : 
+ *  node (tokens in execTokens)
+ * 
+ * Output :
+ *  Bool
+ * 
+*****************************************************************/
+bool substInShell(struct cmdNode* node){
+
+	const struct builtin* cmd;
+	struct token* first;
+	int i;
+
+	if (node == NULL){
+		return true;
+	}
+	switch (node->type){
+		case NODE_SEQ :
+		case NODE_AND :
+		case NODE_OR :
+			return substInShell(node->left) && substInShell(node->right);
+		case NODE_PIPELINE :
+			break;
+		default :
+			return false;
+	}
+
+	if (node->background == true){
+		return false;
+	}
+	//Every stage of a real pipeline is a child process.
+	for (i = node->tokenStart; i < node->tokenEnd; i++){
+		if (execTokens[i].type == TOK_PIPE){
+			return true;
+		}
+	}
+	first = &execTokens[node->tokenStart];
+	if (first->type != TOK_WORD || first->flags != 0 || isAssignment(first->text) == true ||
+	    findFunction(first->text) != NULL){
+		return false;
+	}
+	if ((cmd = findBuiltin(first->text)) == NULL){
+		return true;
+	}
+	return cmd->run == echoCmd || cmd->run == printfCmd || cmd->run == pwdCmd ||
+	       cmd->run == testCmd || cmd->run == trueCmd || cmd->run == falseCmd;
+}
+
+/*****************************************************************
+ * Function name : captureInShell / captureInChild
+ * 
+ * Description :
+ * The two ways of running a $(...). captureInShell points our own
+ * stdout at a memfd for the duration (builtins write there, spawned
+ * commands inherit it), then reads the memfd straight into
+ * lineArena. A memfd rather than a pipe, since nobody could read a
+ * pipe while the shell itself is waiting for the command.
+ *
+ * captureInChild forks the shell, runs the tree in the child with
+ * stdout on a pipe, and reads the pipe as it fills, into
+ * captureBuf.
+ * 
+ * Input  : 
+ *  tree
+ * 
+ * Output :
+ *  The output, outLen. lastStatus.
+ * 
+*****************************************************************/
+char* captureInShell(struct cmdNode* tree, size_t* outLen){
+
+	struct stat info;
+	int     memFd = memfd_create("smallsh-subst", MFD_CLOEXEC);
+	int     savedOut;
+	ssize_t got;
+	size_t  done = 0;
+	char*   out;
+
+	if (memFd < 0){
+		return captureInChild(tree, outLen);
+	}
+	fflush(stdout);
+	savedOut = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, REDIR_FD_LIMIT);
+	dup2(memFd, STDOUT_FILENO);
+
+	runCommandList(tree);
+
+	fflush(stdout);
+	if (savedOut >= 0){
+		dup2(savedOut, STDOUT_FILENO);
+		close(savedOut);
+	}else{
+		close(STDOUT_FILENO);
+	}
+
+	fstat(memFd, &info);
+	out = arenaAlloc(&lineArena, info.st_size + 1);
+	while (done < (size_t)info.st_size &&
+	       (got = pread(memFd, out + done, info.st_size - done, done)) > 0){
+		done += got;
+	}
+	close(memFd);
+	*outLen = done;
+	return out;
+}
+
+char* captureInChild(struct cmdNode* tree, size_t* outLen){
+
+	struct rusage usage;
+	int     pipeFds[2];
+	int     status = 0;
+	ssize_t got;
+	size_t  done = 0;
+	pid_t   pid;
+	char*   out;
+
+	if (pipe2(pipeFds, O_CLOEXEC) < 0){
+		perror("$(...)");
+		lastStatus = 1;
+		return "";
+	}
+	//Anything still buffered would be printed twice otherwise.
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0){
+		perror("$(...)");
+		close(pipeFds[0]);
+		close(pipeFds[1]);
+		lastStatus = 1;
+		return "";
+	}
+	if (pid == 0){
+		//Like any non-interactive shell, the copy does no job control.
+		jobControl = false;
+		dup2(pipeFds[1], STDOUT_FILENO);
+		runCommandList(tree);
+		fflush(stdout);
+		_exit(lastStatus);
+	}
+
+	close(pipeFds[1]);
+	while (true){
+		if (captureCap - done < SPLICE_CHUNK){
+			captureCap = (captureCap == 0) ? SPLICE_CHUNK * 2 : captureCap * 2;
+			captureBuf = realloc(captureBuf, captureCap);
+		}
+		got = read(pipeFds[0], captureBuf + done, captureCap - done);
+		if (got < 0 && errno == EINTR){
+			continue;
+		}
+		if (got <= 0){
+			break;
+		}
+		done += got;
+	}
+	close(pipeFds[0]);
+	waitForeground(pid, &status, &usage);
+	lastStatus = exitCode(status);
+	if (usageSink != NULL){
+		addUsage(usageSink, &usage);
+	}
+
+	out = arenaAlloc(&lineArena, done + 1);
+	memcpy(out, captureBuf, done);
+	*outLen = done;
+	return out;
+}
+
+/*****************************************************************
+ * Function name : countFields / splitFields
+ * 
+ * Description :
+ * Field splitting of a word holding $(...) output : blanks, tabs
+ * and newlines separate fields and runs of them count once.
+ * splitFields ends each field in place and stores the pointers.
+ * 
+ * Input  : 
+ *  text, fields (room for countFields(text) pointers)
+ * 
+ * Output :
+ *  The number of fields.
+ * 
+*****************************************************************/
+int countFields(const char* text){
+
+	int count = 0;
+
+	while (true){
+		text += strspn(text, " \t\n");
+		if (*text == '\0'){
+			return count;
+		}
+		count++;
+		text += strcspn(text, " \t\n");
+	}
+}
+
+int splitFields(char* text, char** fields){
+
+	int count = 0;
+
+	while (true){
+		text += strspn(text, " \t\n");
+		if (*text == '\0'){
+			return count;
+		}
+		fields[count++] = text;
+		text += strcspn(text, " \t\n");
+		if (*text != '\0'){
+			*text++ = '\0';
+		}
+	}
+}
+
+/*****************************************************************
+ * Function name : growArgs
+ * 
+ * Description :
+ * Makes room in lineArgs for need more pointers after argCount,
+ * moving it to a block twice the size when it is short, and
+ * pointing the args of every stage built so far (the current one,
+ * lineStages[numStages], included) into the new block.
+ * 
+ * Input  : 
+ *  argCount, need, argCap
+ * 
+ * Output :
+ *  lineArgs, argCap
+ * 
+*****************************************************************/
+void growArgs(int argCount, int need, int* argCap){
+
+	struct pipeStage* stage;
+	char** moved;
+
+	if (argCount + need <= *argCap){
+		return;
+	}
+	*argCap = (argCount + need) * 2;
+	moved = arenaAlloc(&lineArena, *argCap * sizeof(char*));
+	memcpy(moved, lineArgs, argCount * sizeof(char*));
+	for (stage = lineStages; stage <= &lineStages[numStages]; stage++){
+		stage->args = moved + (stage->args - lineArgs);
+	}
+	lineArgs = moved;
+}
+
+/*****************************************************************
+ * Function name : isPattern / expandGlob
+ * 
+ * Description :
+ * Pathname expansion. A word is a pattern if it has a * or ?, or
+ * a [ with a ] somewhere after it (so "[" and "]" of test stay
+ * plain words). expandGlob splits the pattern at "/" and hands it
+ * to globWalk(), which only lists directories for the parts that
+ * are patterns themselves. Names are matched with fnmatch(); a
+ * leading "." has to be matched explicitly, "." and ".." never
+ * are. The matches are sorted with strcmp unless GLOBSORT is
+ * "nosort".
+ * 
+ * Input  : 
+ *  word / pattern
+ * 
+ * Output :
+ *  isPattern : true if globbing could change it.
+ *  expandGlob : the number of matches, in globMatches (0 : none,
+ *  the word stays as it is).
+ * 
+*****************************************************************/
+bool isPattern(const char* word){
+
+	const char* open;
+
+	if (strpbrk(word, "*?") != NULL){
+		return true;
+	}
+	open = strchr(word, '[');
+	return open != NULL && strchr(open + 2, ']') != NULL && open[1] != '\0';
+}
+
+int expandGlob(const char* pattern){
+
+	char   path[PATH_MAX];
+	size_t len = strlen(pattern);
+	char*  copy = arenaAlloc(&lineArena, len + 1);
+	char** parts = arenaAlloc(&lineArena, (len + 2) * sizeof(char*));
+	char*  sortMode;
+	int    numParts = 1;
+	size_t i;
+	long long spanStart = traceBegin();
+
+	memcpy(copy, pattern, len + 1);
+	parts[0] = copy;
+	for (i = 0; i < len; i++){
+		if (copy[i] == '/'){
+			copy[i] = '\0';
+			parts[numParts++] = &copy[i + 1];
+		}
+	}
+
+	globCount = 0;
+	path[0] = '\0';
+	//An absolute pattern starts with an empty part : the root.
+	if (parts[0][0] == '\0'){
+		strcpy(path, "/");
+		globWalk(path, 1, parts + 1, numParts - 1);
+	}else{
+		globWalk(path, 0, parts, numParts);
+	}
+
+	sortMode = lookupVar("GLOBSORT");
+	if (globCount > 1 && (sortMode == NULL || strEquals(sortMode, "nosort") == false)){
+		qsort(globMatches, globCount, sizeof(char*), compareString);
+	}
+	traceEnd("glob", spanStart, pattern);
+	return globCount;
+}
+
+/*****************************************************************
+ * Function name : globWalk / addMatch
+ * 
+ * Description :
+ * Matches parts (the pattern's "/" separated pieces, empty ones
+ * from "//" or a trailing "/" included) below path, which holds
+ * the directory reached so far (with its trailing "/", or empty
+ * for the current directory). A plain part is just appended; a
+ * pattern is matched against the cached listing of the directory.
+ * Once the parts run out the path is a match if it exists. A
+ * trailing "/" only matches directories, as in sh.
+ * 
+ * Input  : 
+ *  path (PATH_MAX bytes), pathLen, parts, numParts / path
+ * 
+ * Output :
+ *  globMatches, globCount
+ * 
+*****************************************************************/
+void globWalk(char* path, size_t pathLen, char** parts, int numParts){
+
+	struct dirListing* listing;
+	struct stat info;
+	const char* name;
+	size_t nameLen;
+	int    i;
+
+	if (numParts == 0){
+		if (lstat(path, &info) == 0){
+			addMatch(path);
+		}
+		return;
+	}
+	if (isPattern(parts[0]) == false){
+		nameLen = strlen(parts[0]);
+		if (pathLen + nameLen + 2 > PATH_MAX){
+			return;
+		}
+		memcpy(path + pathLen, parts[0], nameLen);
+		//Every part but the last is followed by a "/".
+		if (numParts > 1){
+			path[pathLen + nameLen++] = '/';
+		}
+		path[pathLen + nameLen] = '\0';
+		globWalk(path, pathLen + nameLen, parts + 1, numParts - 1);
+		path[pathLen] = '\0';
+		return;
+	}
+
+	listing = readListing((pathLen == 0) ? "." : path);
+	if (listing == NULL){
+		return;
+	}
+	for (i = 0, name = listing->names; i < listing->count; i++, name += nameLen + 1){
+		nameLen = strlen(name);
+		if (fnmatch(parts[0], name, FNM_PERIOD | FNM_NOESCAPE) != 0 ||
+		    strEquals(name, ".") == true || strEquals(name, "..") == true ||
+		    pathLen + nameLen + 2 > PATH_MAX){
+			continue;
+		}
+		memcpy(path + pathLen, name, nameLen + 1);
+		if (numParts == 1){
+			addMatch(path);
+		}else{
+			path[pathLen + nameLen] = '/';
+			path[pathLen + nameLen + 1] = '\0';
+			//"dir*/" : nothing is left but the trailing "/".
+			if (numParts == 2 && parts[1][0] == '\0'){
+				if (stat(path, &info) == 0 && S_ISDIR(info.st_mode)){
+					addMatch(path);
+				}
+			}else{
+				globWalk(path, pathLen + nameLen + 1, parts + 1, numParts - 1);
+			}
+		}
+	}
+	path[pathLen] = '\0';
+}
+
+void addMatch(const char* path){
+
+	size_t len = strlen(path) + 1;
+
+	if (globCount == globCap){
+		globCap = (globCap == 0) ? 64 : globCap * 2;
+		globMatches = realloc(globMatches, globCap * sizeof(char*));
+	}
+	globMatches[globCount] = arenaAlloc(&lineArena, len);
+	memcpy(globMatches[globCount++], path, len);
+}
+
+/*****************************************************************
+ * Function name : readListing / clearDirCache
+ * 
+ * Description :
+ * The names in directory dir, from dirCache when the directory (by
+ * device and inode, so "." after a cd is another entry) still has
+ * the mtime it had when it was read. Otherwise it is read again
+ * with readdir (glibc fetches getdents64 batches of entries) into
+ * one block of '\0' separated names. The cache is emptied whenever
+ * it reaches DIRCACHE_MAX listings.
+ * 
+ * Input  : 
+ *  dir
+ * 
+ * Output :
+ *  The listing, NULL if dir is not a readable directory.
+ * 
+*****************************************************************/
+struct dirListing* readListing(const char* dir){
+
+	struct dirListing* listing;
+	struct dirent* entry;
+	struct stat info;
+	DIR*   stream;
+	size_t used = 0;
+	size_t cap = 4096;
+	size_t len;
+	int    dirFd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	if (dirFd < 0){
+		return NULL;
+	}
+	fstat(dirFd, &info);
+	for (listing = dirCache[info.st_ino % HASH_BUCKETS]; listing != NULL; listing = listing->next){
+		if (listing->ino == info.st_ino && listing->dev == info.st_dev){
+			break;
+		}
+	}
+	if (listing != NULL && listing->mtime.tv_sec == info.st_mtim.tv_sec &&
+	    listing->mtime.tv_nsec == info.st_mtim.tv_nsec && listing->readAt > info.st_mtim.tv_sec + 1){
+		close(dirFd);
+		return listing;
+	}
+
+	if (listing == NULL){
+		if (dirCacheSize >= DIRCACHE_MAX){
+			clearDirCache();
+		}
+		listing = malloc(sizeof(struct dirListing));
+		listing->dev = info.st_dev;
+		listing->ino = info.st_ino;
+		listing->names = NULL;
+		listing->next = dirCache[info.st_ino % HASH_BUCKETS];
+		dirCache[info.st_ino % HASH_BUCKETS] = listing;
+		dirCacheSize++;
+	}
+	listing->mtime = info.st_mtim;
+	listing->readAt = time(NULL);
+	listing->count = 0;
+	listing->names = realloc(listing->names, cap);
+
+	stream = fdopendir(dirFd);
+	while ((entry = readdir(stream)) != NULL){
+		len = strlen(entry->d_name) + 1;
+		if (used + len > cap){
+			cap *= 2;
+			listing->names = realloc(listing->names, cap);
+		}
+		memcpy(listing->names + used, entry->d_name, len);
+		used += len;
+		listing->count++;
+	}
+	closedir(stream);
+	return listing;
+}
+
+void clearDirCache(){
+
+	struct dirListing* listing;
+	struct dirListing* next;
+	int i;
+
+	for (i = 0; i < HASH_BUCKETS; i++){
+		for (listing = dirCache[i]; listing != NULL; listing = next){
+			next = listing->next;
+			free(listing->names);
+			free(listing);
+		}
+		dirCache[i] = NULL;
+	}
+	dirCacheSize = 0;
+}
+
+int compareString(const void* a, const void* b){
+
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/*****************************************************************
+ * Function name : joinTokens
+ * 
+ * Description :
+ * Puts the tokens of the command being run back together with
+ * single spaces, for the command line shown by "jobs".
+ * 
+ * Input  : 
+ *  out, outSize
+ * 
+ * Output :
+ *  out
+ * 
+*****************************************************************/
+void joinTokens(char* out, size_t outSize){
+
+	size_t used = 0;
+	int i;
+
+	out[0] = '\0';
+	for (i = cmdTokenStart; i < cmdTokenEnd && used < outSize; i++){
+		used += snprintf(out + used, outSize - used, (i == cmdTokenStart) ? "%s" : " %s", execTokens[i].text);
+	}
+}
+
+//Function calls go through runBuiltin() too, for the redirections.
+const struct builtin functionCall = { "function", callFunction, false };
+
+/*****************************************************************
+* Function name : bCMDs
+* Description :
+* 
+*	This function checks for built in functions. Comments and
+*   blank lines have no stages and do nothing; pipelines always
+*   go to progFork(). A single command made only of NAME=value
+*   words sets shell variables. Otherwise the first word is looked
+*   up among the functions, then in builtinTable, and if it is
+*   there, run in the shell itself. A leading "time" is taken off
+*   and handled by timeCommand(), a leading "timeout" by
+*   timeoutCommand().
+*
+*   Called once per pipeline of the line by runCommandList().
+*
+* This program effects  :
+*  exitTheChild, lastStatus, backgrFlag
+
+* Outputs : 
+*  whatever the built in prints
+*  
+* This program will call progFork(); if the command is not built in
+*
+*****************************************************************/
+void bCMDs(){
+
+	const struct builtin* cmd;
+	bool background;
+	long long spanStart = traceBegin();
+	const char* name = (numStages > 0) ? lineStages[0].args[0] : NULL;
+
+	if (numStages > 0 && strEquals(lineStages[0].args[0], "time") == true){
+		timeCommand();
+		traceEnd("command", spanStart, name);
+		return;
+	}
+
+	if (numStages > 0 && strEquals(lineStages[0].args[0], "timeout") == true){
+		timeoutCommand();
+		traceEnd("command", spanStart, name);
+		return;
+	}
+
+	if (numStages == 1 && isAssignment(lineStages[0].args[0]) == true &&
+	    assignVars(lineStages[0].args) == true){
+		lastStatus = 0;
+	}
+
+	else if (numStages == 1 && (calledFunction = findFunction(lineStages[0].args[0])) != NULL){
+		runBuiltin(&functionCall, &lineStages[0]);
+	}
+
+	else if (numStages == 1 && (cmd = findBuiltin(lineStages[0].args[0])) != NULL){
+		//Built ins always run in the foreground; "&" only matters
+		// if kill hands the line on to progFork().
+		runBuiltin(cmd, &lineStages[0]);
+	}
+
+	//If and only if it is not built in we fork our process.
+	else if (numStages > 0){
+		//progFork() clears backgrFlag once the job is registered.
+		background = backgrFlag;
+		progFork();
+		lastStatus = (background == true) ? 0 : exitCode(exitTheChild);
+	}else{
+		lastStatus = 0;
+	}
+    
+	backgrFlag = false;
+	traceEnd("command", spanStart, name);
+}
+
+/*****************************************************************
+* Function name : timeCommand
+* Description :
+*	"time cmd ...", "time a | b" : runs the rest of the command the
+*	usual way (built in, function or external) and prints to stderr
+*	what it took : wall time, then user / system CPU of its children
+*	(collected by wait4 through usageSink) plus the shell's own for
+*	whatever ran inside it, peak RSS of the biggest child (the
+*	shell's, if nothing was started), and context switches. A
+*	background command is only started, not timed.
+*
+* Input  : None (lineStages)
+* Output : The usage line.
+*****************************************************************/
+void timeCommand(){
+
+	struct timespec start;
+	struct rusage selfBefore, selfAfter, total;
+	struct rusage* savedSink = usageSink;
+	bool   background = backgrFlag;
+	double wall;
+
+	lineStages[0].args++;
+	if (lineStages[0].args[0] == NULL){
+		if (numStages > 1){
+			printf("time : empty command in pipeline\n");
+			fflush(stdout);
+			lastStatus = 2;
+			return;
+		}
+		numStages = 0;
+	}
+
+	memset(&total, 0, sizeof(total));
+	usageSink = &total;
+	getrusage(RUSAGE_SELF, &selfBefore);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	bCMDs();
+
+	wall = secondsSince(&start);
+	getrusage(RUSAGE_SELF, &selfAfter);
+	usageSink = savedSink;
+	if (background == true){
+		return;
+	}
+
+	timersub(&selfAfter.ru_utime, &selfBefore.ru_utime, &selfAfter.ru_utime);
+	timersub(&selfAfter.ru_stime, &selfBefore.ru_stime, &selfAfter.ru_stime);
+	selfAfter.ru_nvcsw -= selfBefore.ru_nvcsw;
+	selfAfter.ru_nivcsw -= selfBefore.ru_nivcsw;
+	if (total.ru_maxrss > 0){
+		selfAfter.ru_maxrss = 0;
+	}
+	addUsage(&total, &selfAfter);
+	if (savedSink != NULL){
+		addUsage(savedSink, &total);
+	}
+
+	fflush(stdout);
+	printUsage(stderr, "", wall, &total);
+}
+
+/*****************************************************************
+* Function name : timeoutCommand
+* Description :
+*	"timeout [-k GRACE] DURATION cmd ..." : runs the rest of the
+*	command the usual way with a deadline armed. Every foreground
+*	wait while it is armed goes through waitDeadline() first
+*	(parallel's too, over all its running tasks), so it covers a
+*	pipeline, or a function, loop or parallel starting several
+*	commands, as a whole. A background command is only started,
+*	not timed. If the deadline hit, status reads 124, as in
+*	coreutils. DURATION 0 means no limit. A timeout inside another
+*	one can only make the deadline earlier.
+*
+* Input  : None (lineStages)
+* Output : exitTheChild, lastStatus
+*****************************************************************/
+void timeoutCommand(){
+
+	char** args = lineStages[0].args;
+	struct timespec savedAt = timeoutAt;
+	struct timespec deadline;
+	bool   savedArmed = timeoutArmed;
+	bool   savedFired = timeoutFired;
+	double savedKillAfter = timeoutKillAfter;
+	double limit;
+	double killAfter = TIMEOUT_KILL_AFTER;
+	int    i = 1;
+
+	if (args[1] != NULL && strEquals(args[1], "-k") == true && args[2] != NULL){
+		killAfter = parseDuration(args[2]);
+		i = 3;
+	}
+	if (args[i] == NULL || args[i + 1] == NULL || (limit = parseDuration(args[i])) < 0 || killAfter < 0){
+		printf("usage : timeout [-k DURATION] DURATION cmd args...\n");
+		fflush(stdout);
+		exitTheChild = 125 << 8;
+		lastStatus = 125;
+		return;
+	}
+	lineStages[0].args += i + 1;
+	if (backgrFlag == true || limit == 0){
+		bCMDs();
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += (time_t)limit;
+	deadline.tv_nsec += (long)((limit - (time_t)limit) * 1e9);
+	if (deadline.tv_nsec >= 1000000000){
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+	if (savedArmed == false || secondsUntil(&deadline) < secondsUntil(&savedAt)){
+		timeoutAt = deadline;
+		timeoutKillAfter = killAfter;
+	}
+	timeoutArmed = true;
+	timeoutFired = false;
+
+	bCMDs();
+
+	if (timeoutFired == true){
+		exitTheChild = 124 << 8;
+		lastStatus = 124;
+	}
+	timeoutAt = savedAt;
+	timeoutArmed = savedArmed;
+	timeoutFired = (savedFired == true || timeoutFired == true);
+	timeoutKillAfter = savedKillAfter;
+}
+
+/*****************************************************************
+* Function name : parseDuration / secondsUntil
+* Description :
+*	A timeout duration : a number of seconds, fractions allowed,
+*	with an optional s, m, h or d suffix. secondsUntil is how far
+*	in the future (negative : past) a CLOCK_MONOTONIC time is.
+*
+* Input  : text / when
+* Output : seconds, parseDuration : -1 if it is not a duration
+*****************************************************************/
+double parseDuration(const char* text){
+
+	char*  end;
+	double value = strtod(text, &end);
+
+	if (end == text || value < 0){
+		return -1;
+	}
+	if (*end == '\0' || strEquals(end, "s") == true){
+		return value;
+	}else if (strEquals(end, "m") == true){
+		return value * 60;
+	}else if (strEquals(end, "h") == true){
+		return value * 3600;
+	}else if (strEquals(end, "d") == true){
+		return value * 86400;
+	}
+	return -1;
+}
+
+double secondsUntil(const struct timespec* when){
+
+	return -secondsSince(when);
+}
+
+/*****************************************************************
+* Function name : waitDeadline
+* Description :
+*	Called before the blocking wait4 of a foreground command while
+*	a timeout is armed. Waits until one of pids exits or the
+*	deadline passes : poll() on their pidfds, which become readable
+*	when the process exits, so there is no busy loop and no race
+*	with SIGCHLD. Kernels without pidfd_open get waitid(WNOWAIT)
+*	every TIMEOUT_POLL_MS instead (on any child, for more than
+*	one pid; the caller's wait4 sorts it out).
+*
+*	At the deadline the command gets SIGTERM plus SIGCONT, so a
+*	stopped one sees it too; if it is still there
+*	timeoutKillAfter later, SIGKILL. deadlineSignal sends them to
+*	the whole process group, if it has one, otherwise to each pid.
+*	The caller's wait4 collects it either way.
+*
+* Input  : pids, count, pgid (0 : they share the shell's group) /
+*          and signo
+* Output : timeoutFired
+*****************************************************************/
+void waitDeadline(const pid_t* pids, int count, pid_t pgid){
+
+	struct pollfd* exitFds = malloc(count * sizeof(struct pollfd));
+	siginfo_t info;
+	double left;
+	bool   havePidfds = true;
+	int    ready;
+	int    i;
+
+	for (i = 0; i < count; i++){
+		exitFds[i].fd = syscall(SYS_pidfd_open, pids[i], 0);
+		exitFds[i].events = POLLIN;
+		if (exitFds[i].fd < 0){
+			havePidfds = false;
+		}
+	}
+	//Past the deadline already (a later command of a function or
+	// loop) : it gets the SIGTERM straight away.
+	if (timeoutFired == true){
+		deadlineSignal(pids, count, pgid, SIGTERM);
+		deadlineSignal(pids, count, pgid, SIGCONT);
+	}
+
+	for (;;){
+		left = secondsUntil(&timeoutAt);
+		if (timeoutFired == true){
+			left += timeoutKillAfter;
+		}
+		if (left <= 0){
+			if (timeoutFired == true){
+				deadlineSignal(pids, count, pgid, SIGKILL);
+				break;
+			}
+			deadlineSignal(pids, count, pgid, SIGTERM);
+			deadlineSignal(pids, count, pgid, SIGCONT);
+			timeoutFired = true;
+			continue;
+		}
+
+		if (havePidfds == true){
+			ready = poll(exitFds, count, (int)(left * 1000) + 1);
+		}else{
+			info.si_pid = 0;
+			ready = waitid((count == 1) ? P_PID : P_ALL, pids[0], &info, WEXITED | WNOHANG | WNOWAIT);
+			if (ready == 0 && info.si_pid == 0){
+				poll(NULL, 0, (left * 1000 < TIMEOUT_POLL_MS) ? (int)(left * 1000) + 1 : TIMEOUT_POLL_MS);
+			}else{
+				ready = 1;
+			}
+		}
+		if (ready > 0 || (ready < 0 && errno != EINTR)){
+			break;
+		}
+	}
+	for (i = 0; i < count; i++){
+		if (exitFds[i].fd >= 0){
+			close(exitFds[i].fd);
+		}
+	}
+	free(exitFds);
+}
+
+void deadlineSignal(const pid_t* pids, int count, pid_t pgid, int signo){
+
+	int i;
+
+	if (pgid > 0){
+		kill(-pgid, signo);
+		return;
+	}
+	for (i = 0; i < count; i++){
+		kill(pids[i], signo);
+	}
+}
+
+/*****************************************************************
+* Function name : addUsage / printUsage / secondsSince
+* Description :
+*	Resource use bookkeeping. addUsage adds part's CPU times and
+*	context switches to total and keeps the larger peak RSS (the
+*	stages of a pipeline run side by side, so their peaks do not
+*	add up). printUsage writes one line of it. secondsSince is
+*	the monotonic time elapsed since start.
+*
+* Input  : total, part / out, lead (put in front), wall, usage /
+*          start
+* Output : total / the line / seconds
+*****************************************************************/
+void addUsage(struct rusage* total, const struct rusage* part){
+
+	timeradd(&total->ru_utime, &part->ru_utime, &total->ru_utime);
+	timeradd(&total->ru_stime, &part->ru_stime, &total->ru_stime);
+	if (part->ru_maxrss > total->ru_maxrss){
+		total->ru_maxrss = part->ru_maxrss;
+	}
+	total->ru_nvcsw += part->ru_nvcsw;
+	total->ru_nivcsw += part->ru_nivcsw;
+}
+
+void printUsage(FILE* out, const char* lead, double wall, const struct rusage* usage){
+
+	fprintf(out, "%sreal %.3fs  user %.3fs  sys %.3fs  maxrss %ldKB  csw %ld vol %ld invol\n", lead, wall,
+	        usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6,
+	        usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6,
+	        usage->ru_maxrss, usage->ru_nvcsw, usage->ru_nivcsw);
+}
+
+double secondsSince(const struct timespec* start){
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*****************************************************************
+* Function name : benchCmd
+* Description :
+*	bench [-n N] [-w W] [--show-output] -- cmd args...
+*	bench --compare [-n N] [-w W] [--show-output] -- cmdA ... -- cmdB ...
+*
+*	Runs the command W times unmeasured, then N times measured,
+*	each run through progFork() exactly like a typed command
+*	(lookup, redirection opens, spawn, wait4). The command's
+*	stdout goes to /dev/null, through an ordinary "> /dev/null"
+*	redirection, unless --show-output is given. With --compare the
+*	two commands take turns on every run. ^C stops the bench.
+*
+* Input  : args
+* Output : The report. 0, 1 if any run failed, 2 on a usage error.
+*****************************************************************/
+int benchCmd(char* args[]){
+
+	struct pipeStage* savedStages = lineStages;
+	struct pipeStage  stages[2];
+	struct redirect   quiet = { STDOUT_FILENO, REDIR_OUT, 0, "/dev/null", -1 };
+	struct benchSamples samples[2];
+	int  savedNumStages = numStages;
+	int  runs = BENCH_RUNS;
+	int  warmup = BENCH_WARMUP;
+	int  numCmds = 1;
+	int  done = 0;
+	bool compare = false;
+	bool showOutput = false;
+	bool stopped = false;
+	int  i, c;
+
+	for (i = 1; args[i] != NULL && strEquals(args[i], "--") == false; i++){
+		if (strEquals(args[i], "-n") == true && args[i + 1] != NULL){
+			runs = atoi(args[++i]);
+		}else if (strEquals(args[i], "-w") == true && args[i + 1] != NULL){
+			warmup = atoi(args[++i]);
+		}else if (strEquals(args[i], "--compare") == true){
+			compare = true;
+		}else if (strEquals(args[i], "--show-output") == true){
+			showOutput = true;
+		}else{
+			break;
+		}
+	}
+	if (args[i] == NULL || strEquals(args[i], "--") == false || args[i + 1] == NULL ||
+	    runs < 1 || warmup < 0){
+		printf("usage : bench [-n N] [-w W] [--show-output] -- cmd args...\n"
+		       "        bench --compare [-n N] [-w W] [--show-output] -- cmdA ... -- cmdB ...\n");
+		fflush(stdout);
+		return 2;
+	}
+
+	//Split the command(s) off in place : the second "--" ends the first.
+	stages[0].args = &args[i + 1];
+	if (compare == true){
+		for (i++; args[i] != NULL && strEquals(args[i], "--") == false; i++){
+		}
+		if (args[i] == NULL || args[i + 1] == NULL || &args[i] == stages[0].args){
+			printf("bench : --compare needs two commands separated by --\n");
+			fflush(stdout);
+			return 2;
+		}
+		args[i] = NULL;
+		stages[1].args = &args[i + 1];
+		numCmds = 2;
+	}
+	for (c = 0; c < numCmds; c++){
+		stages[c].redirs = &quiet;
+		stages[c].numRedirs = (showOutput == true) ? 0 : 1;
+		samples[c].wall = arenaAlloc(&lineArena, runs * sizeof(double));
+		samples[c].cpu = arenaAlloc(&lineArena, runs * sizeof(double));
+		samples[c].rss = arenaAlloc(&lineArena, runs * sizeof(double));
+		samples[c].failed = 0;
+	}
+
+	for (i = -warmup; i < runs && stopped == false; i++){
+		for (c = 0; c < numCmds && stopped == false; c++){
+			stopped = benchRun(&stages[c], &samples[c], i);
+		}
+		if (stopped == false && i >= 0){
+			done++;
+		}
+	}
+	lineStages = savedStages;
+	numStages = savedNumStages;
+
+	if (done == 0){
+		printf("bench : interrupted before the first measured run\n");
+		fflush(stdout);
+		return 1;
+	}
+	for (c = 0; c < numCmds; c++){
+		benchReport(&stages[c], &samples[c], done);
+	}
+	if (compare == true){
+		printf("median wall %s / %s : %.3fx\n", stages[1].args[0], stages[0].args[0],
+		       percentile(samples[1].wall, done, 50) / percentile(samples[0].wall, done, 50));
+	}
+	fflush(stdout);
+	return (samples[0].failed > 0 || (numCmds > 1 && samples[1].failed > 0)) ? 1 : 0;
+}
+
+/*****************************************************************
+* Function name : benchRun / benchReport
+* Description :
+*	benchRun starts one run of stage through progFork() and, for
+*	a measured run (run >= 0), stores its wall time, CPU (user +
+*	system) and peak RSS from wait4. benchReport sorts the samples
+*	and prints min / median / p95 / p99 / max of each.
+*
+* Input  : stage, samples, run (negative : warm-up) / runs
+* Output : benchRun : true if the run was ended by ^C.
+*****************************************************************/
+bool benchRun(struct pipeStage* stage, struct benchSamples* samples, int run){
+
+	struct timespec start;
+	double wall;
+
+	lineStages = stage;
+	numStages = 1;
+	backgrFlag = false;
+	//A command that never starts leaves no usage behind.
+	memset(&lastUsage, 0, sizeof(lastUsage));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	progFork();
+	wall = secondsSince(&start);
+
+	if (WIFSIGNALED(exitTheChild) && WTERMSIG(exitTheChild) == SIGINT){
+		return true;
+	}
+	if (run < 0){
+		return false;
+	}
+	if (exitTheChild != 0){
+		samples->failed++;
+	}
+	samples->wall[run] = wall * 1000;
+	samples->cpu[run] = (lastUsage.ru_utime.tv_sec + lastUsage.ru_stime.tv_sec) * 1000.0 +
+	                    (lastUsage.ru_utime.tv_usec + lastUsage.ru_stime.tv_usec) / 1000.0;
+	samples->rss[run] = lastUsage.ru_maxrss;
+	return false;
+}
+
+void benchReport(struct pipeStage* stage, struct benchSamples* samples, int runs){
+
+	const char* rowName[3] = { "wall ms", "cpu ms", "rss KB" };
+	int     decimals[3] = { 3, 3, 0 };
+	double* rows[3] = { samples->wall, samples->cpu, samples->rss };
+	int r, i;
+
+	printf("bench :");
+	for (i = 0; stage->args[i] != NULL; i++){
+		printf(" %s", stage->args[i]);
+	}
+	printf("  (%d runs", runs);
+	if (samples->failed > 0){
+		printf(", %d failed", samples->failed);
+	}
+	printf(")\n%-8s %10s %10s %10s %10s %10s\n", "", "min", "median", "p95", "p99", "max");
+	for (r = 0; r < 3; r++){
+		qsort(rows[r], runs, sizeof(double), compareDouble);
+		printf("%-8s %10.*f %10.*f %10.*f %10.*f %10.*f\n", rowName[r],
+		       decimals[r], rows[r][0], decimals[r], percentile(rows[r], runs, 50),
+		       decimals[r], percentile(rows[r], runs, 95), decimals[r], percentile(rows[r], runs, 99),
+		       decimals[r], rows[r][runs - 1]);
+	}
+}
+
+/*****************************************************************
+* Function name : compareDouble / percentile
+* Description :
+*	qsort order for doubles, and the nearest-rank percentile of a
+*	sorted array.
+*
+* Input  : a, b / sorted, count, percent
+* Output : <0, 0, >0 / the value
+*****************************************************************/
+int compareDouble(const void* a, const void* b){
+
+	double left = *(const double*)a;
+	double right = *(const double*)b;
+
+	return (left > right) - (left < right);
+}
+
+double percentile(double* sorted, int count, int percent){
+
+	int rank = (count * percent + 99) / 100;
+
+	return sorted[(rank < 1) ? 0 : rank - 1];
+}
+
+/*****************************************************************
+* Function name : parallelCmd
+* Description :
+*	parallel [-j N] -- cmd args... [::: item ...]
+*
+*	Runs cmd once for every item, never more than N at a time (by
+*	default the number of online CPUs). The items are the words
+*	after ":::", or else the non-empty lines of stdin. Every "{}"
+*	in the arguments is replaced by the item; if there is none the
+*	item is added as the last argument.
+*
+*	The shell blocks in wait4 and, as soon as a task exits, writes
+*	out its output and starts the next item in its slot. Children
+*	that are not ours (background jobs) go to collectChild() and
+*	are reported at the next prompt as usual. What the tasks used
+*	is added up for "status -v" and "time".
+*
+*	Under job control the running tasks share one process group,
+*	which has the terminal, so ^C reaches them; after a ^C no
+*	more items are started. ^Z does not stop the batch : a
+*	stopped task is continued.
+*
+*	The summary (items, failures, wall time) and every failed item
+*	go to stderr.
+*
+* Input  : args
+* Output : 0 if every item succeeded, 1 if any failed, 130 after a
+*	^C, 2 on a usage error; status reports it.
+*****************************************************************/
+int parallelCmd(char* args[]){
+
+	struct parallelTask* tasks;
+	struct timespec start;
+	struct rusage usage;
+	char** cmdArgs;
+	char** items;
+	char*  itemBuf = NULL;
+	int*   itemStatus;
+	long   jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	int    numItems = 0;
+	int    next = 0;
+	int    running = 0;
+	int    failed = 0;
+	int    childStatus, i, t;
+	bool   fromStdin = false;
+	bool   interrupted = false;
+	bool   handedOver = false;
+	bool   expired;
+	pid_t  pgid = 0;
+	pid_t  donePid;
+	pid_t* runningPids;
+	int    numRunning;
+
+	for (i = 1; args[i] != NULL && strEquals(args[i], "--") == false; i++){
+		if (strEquals(args[i], "-j") == true && args[i + 1] != NULL){
+			jobs = atol(args[++i]);
+		}else if (strncmp(args[i], "-j", 2) == 0 && args[i][2] != '\0'){
+			jobs = atol(args[i] + 2);
+		}else{
+			break;
+		}
+	}
+	if (args[i] == NULL || strEquals(args[i], "--") == false || args[i + 1] == NULL ||
+	    strEquals(args[i + 1], ":::") == true || jobs < 1){
+		printf("usage : parallel [-j N] -- cmd args... [{}] [::: item ...]\n");
+		fflush(stdout);
+		return 2;
+	}
+
+	//Split the item list off in place, as bench does with its "--".
+	cmdArgs = &args[i + 1];
+	for (i++; args[i] != NULL && strEquals(args[i], ":::") == false; i++){
+	}
+	if (args[i] != NULL){
+		args[i] = NULL;
+		items = &args[i + 1];
+		for (numItems = 0; items[numItems] != NULL; numItems++){
+		}
+	}else{
+		items = parallelItems(&itemBuf, &numItems);
+		fromStdin = true;
+	}
+
+	if (numItems > 0 && jobs > numItems){
+		jobs = numItems;
+	}
+	tasks = arenaAlloc(&lineArena, jobs * sizeof(struct parallelTask));
+	memset(tasks, 0, jobs * sizeof(struct parallelTask));
+	itemStatus = arenaAlloc(&lineArena, (numItems + 1) * sizeof(int));
+	runningPids = arenaAlloc(&lineArena, jobs * sizeof(pid_t));
+	//Under "timeout", no new task is started once the deadline hit.
+	expired = (timeoutArmed == true && timeoutFired == true);
+	memset(&lastUsage, 0, sizeof(lastUsage));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	fflush(stdout);
+
+	while (running > 0 || (next < numItems && interrupted == false && expired == false)){
+		//Every free slot gets the next item.
+		for (t = 0; t < jobs && next < numItems && interrupted == false && expired == false; t++){
+			if (tasks[t].pid > 0){
+				continue;
+			}
+			tasks[t].item = next;
+			itemStatus[next] = 0;
+			if (parallelStart(&tasks[t], cmdArgs, items[next], &pgid) == true){
+				running++;
+				if (handedOver == false){
+					handedOver = giveTerminal(pgid);
+				}
+			}else{
+				itemStatus[next] = 127 << 8;
+				failed++;
+			}
+			next++;
+		}
+		if (running == 0){
+			continue;
+		}
+
+		if (timeoutArmed == true){
+			for (t = 0, numRunning = 0; t < jobs; t++){
+				if (tasks[t].pid > 0){
+					runningPids[numRunning++] = tasks[t].pid;
+				}
+			}
+			waitDeadline(runningPids, numRunning, pgid);
+			expired = timeoutFired;
+		}
+		donePid = wait4(-1, &childStatus, (jobControl == true) ? WUNTRACED : 0, &usage);
+		if (donePid < 0){
+			if (errno == EINTR){
+				continue;
+			}
+			break;
+		}
+		for (t = 0; t < jobs && tasks[t].pid != donePid; t++){
+		}
+		if (t == jobs){
+			collectChild(donePid, childStatus, &usage);
+			continue;
+		}
+		if (WIFSTOPPED(childStatus)){
+			kill(donePid, SIGCONT);
+			continue;
+		}
+
+		tasks[t].pid = 0;
+		running--;
+		parallelOutput(&tasks[t]);
+		addUsage(&lastUsage, &usage);
+		itemStatus[tasks[t].item] = childStatus;
+		if (childStatus != 0){
+			failed++;
+		}
+		if (WIFSIGNALED(childStatus) && WTERMSIG(childStatus) == SIGINT){
+			interrupted = true;
+			lineInterrupted = true;
+		}
+		//The group is gone with its last task; the next one starts
+		// a new group, which gets the terminal in turn.
+		if (running == 0){
+			if (handedOver == true){
+				takeTerminal();
+				handedOver = false;
+			}
+			pgid = 0;
+		}
+	}
+
+	lastWall = secondsSince(&start);
+	lastUsageValid = true;
+	if (usageSink != NULL){
+		addUsage(usageSink, &lastUsage);
+	}
+	if (interrupted == true && jobControl == true){
+		printf("\n");
+		fflush(stdout);
+	}
+
+	fprintf(stderr, "parallel : %d items, %d failed, -j %ld, %.3fs\n", next, failed, jobs, lastWall);
+	for (i = 0; i < next; i++){
+		if (itemStatus[i] == 0){
+			continue;
+		}
+		if (WIFSIGNALED(itemStatus[i])){
+			fprintf(stderr, "  failed : %s (signal %d)\n", items[i], WTERMSIG(itemStatus[i]));
+		}else{
+			fprintf(stderr, "  failed : %s (exit %d)\n", items[i], WEXITSTATUS(itemStatus[i]));
+		}
+	}
+	if (next < numItems){
+		fprintf(stderr, "  interrupted : %d items not started\n", numItems - next);
+	}
+
+	if (fromStdin == true){
+		free(items);
+		free(itemBuf);
+	}
+	if (interrupted == true){
+		return 128 + SIGINT;
+	}
+	return (failed > 0) ? 1 : 0;
+}
+
+/*****************************************************************
+* Function name : parallelItems
+* Description :
+*	Reads all of stdin (from where the script is, if the script is
+*	stdin, like any command that reads it) and splits it into
+*	lines; empty lines are skipped. The lines stay in itemBuf.
+*
+* Input  : None
+* Output : The NULL terminated item array, itemBuf, numItems. Both
+*	are malloc'd and freed by the caller.
+*****************************************************************/
+char** parallelItems(char** itemBuf, int* numItems){
+
+	size_t  cap = BATCH_BLOCK;
+	size_t  len = 0;
+	ssize_t got;
+	char*   buf = malloc(cap + 1);
+	char*   line;
+	char*   end;
+	char**  items;
+	int     count = 0;
+
+	syncScriptOffset();
+	for (;;){
+		if (len == cap){
+			cap *= 2;
+			buf = realloc(buf, cap + 1);
+		}
+		got = read(STDIN_FILENO, buf + len, cap - len);
+		if (got < 0 && errno == EINTR){
+			continue;
+		}
+		if (got <= 0){
+			break;
+		}
+		len += got;
+	}
+	resumeScriptOffset();
+	buf[len] = '\n';
+
+	//Every item ends at a newline, so there are at most that many.
+	for (line = buf; line < buf + len; line = end + 1){
+		end = memchr(line, '\n', buf + len + 1 - line);
+		count++;
+	}
+	items = malloc((count + 1) * sizeof(char*));
+	count = 0;
+	for (line = buf; line < buf + len; line = end + 1){
+		end = memchr(line, '\n', buf + len + 1 - line);
+		*end = '\0';
+		if (end > line){
+			items[count++] = line;
+		}
+	}
+	items[count] = NULL;
+
+	*itemBuf = buf;
+	*numItems = count;
+	return items;
+}
+
+/*****************************************************************
+* Function name : parallelStart / parallelOutput
+* Description :
+*	parallelStart spawns one task for item : stdin on /dev/null,
+*	stdout and stderr on a fresh memfd, in process group *pgid (0 :
+*	a new one, which *pgid is then set to; without job control it
+*	stays in the shell's group and *pgid stays 0). It is forked instead
+*	when ulimit settings have to be applied. parallelOutput writes
+*	out everything a finished task printed, in one piece, and
+*	closes its memfd.
+*
+* Input  : task, cmdArgs, item, pgid / task
+* Output : parallelStart : false (after the usual error message) if
+*	the command could not be started.
+*****************************************************************/
+bool parallelStart(struct parallelTask* task, char* cmdArgs[], const char* item, pid_t* pgid){
+
+	posix_spawn_file_actions_t fileActions;
+	posix_spawnattr_t attrs;
+	long long spanStart;
+	char** taskArgs;
+	char*  brace;
+	char*  out;
+	bool   placed = false;
+	int    spawnErr, numArgs, i;
+	size_t itemLen = strlen(item);
+
+	for (numArgs = 0; cmdArgs[numArgs] != NULL; numArgs++){
+	}
+	taskArgs = malloc((numArgs + 2) * sizeof(char*));
+	for (i = 0; i < numArgs; i++){
+		taskArgs[i] = cmdArgs[i];
+		if (strstr(cmdArgs[i], "{}") == NULL){
+			continue;
+		}
+		//Each "{}" becomes the item; the item can not be shorter.
+		taskArgs[i] = out = malloc(strlen(cmdArgs[i]) * (itemLen + 1) + 1);
+		for (brace = cmdArgs[i]; *brace != '\0'; brace++){
+			if (brace[0] == '{' && brace[1] == '}'){
+				memcpy(out, item, itemLen);
+				out += itemLen;
+				brace++;
+			}else{
+				*out++ = *brace;
+			}
+		}
+		*out = '\0';
+		placed = true;
+	}
+	if (placed == false){
+		taskArgs[numArgs++] = (char*)item;
+	}
+	taskArgs[numArgs] = NULL;
+
+	task->outFd = memfd_create("smallsh-parallel", MFD_CLOEXEC);
+	//ulimit settings can only be applied between fork and exec.
+	if (limitsActive == true){
+		spanStart = traceBegin();
+		task->pid = fork();
+		if (task->pid == 0){
+			if (jobControl == true){
+				setpgid(0, *pgid);
+			}
+			childSignals();
+			applyLimits();
+			dup2(open("/dev/null", O_RDONLY | O_CLOEXEC), STDIN_FILENO);
+			if (task->outFd >= 0){
+				dup2(task->outFd, STDOUT_FILENO);
+				dup2(task->outFd, STDERR_FILENO);
+			}
+			execCmd(taskArgs);
+			perror("Error : ");
+			printf(" ' %s ' does not exist as a file or directory and cannot be found. \n", taskArgs[0]);
+			fflush(stdout);
+			exit(127);
+		}
+		traceEnd("fork", spanStart, taskArgs[0]);
+		if (task->pid > 0 && jobControl == true){
+			setpgid(task->pid, (*pgid > 0) ? *pgid : task->pid);
+		}
+		spawnErr = (task->pid < 0) ? errno : 0;
+	}else{
+		posix_spawn_file_actions_init(&fileActions);
+		posix_spawn_file_actions_addopen(&fileActions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+		if (task->outFd >= 0){
+			posix_spawn_file_actions_adddup2(&fileActions, task->outFd, STDOUT_FILENO);
+			posix_spawn_file_actions_adddup2(&fileActions, task->outFd, STDERR_FILENO);
+		}
+		jobSpawnAttrs(&attrs, *pgid);
+		spanStart = traceBegin();
+		spawnErr = spawnResolved(&task->pid, taskArgs, &fileActions, &attrs);
+		traceEnd("spawn", spanStart, taskArgs[0]);
+		posix_spawnattr_destroy(&attrs);
+		posix_spawn_file_actions_destroy(&fileActions);
+	}
+
+	if (spawnErr != 0){
+		errno = spawnErr;
+		perror("Error : ");
+		printf(" ' %s ' does not exist as a file or directory and cannot be found. \n", taskArgs[0]);
+		fflush(stdout);
+		task->pid = 0;
+		if (task->outFd >= 0){
+			close(task->outFd);
+		}
+	}else if (*pgid == 0 && jobControl == true){
+		*pgid = task->pid;
+	}
+	for (i = 0; cmdArgs[i] != NULL; i++){
+		if (taskArgs[i] != cmdArgs[i]){
+			free(taskArgs[i]);
+		}
+	}
+	free(taskArgs);
+	return spawnErr == 0;
+}
+
+void parallelOutput(struct parallelTask* task){
+
+	char    chunk[PARALLEL_CHUNK];
+	off_t   offset = 0;
+	ssize_t got, put, done;
+
+	if (task->outFd < 0){
+		return;
+	}
+	fflush(stdout);
+	while ((got = pread(task->outFd, chunk, sizeof(chunk), offset)) > 0){
+		offset += got;
+		for (done = 0; done < got; done += put){
+			put = write(STDOUT_FILENO, chunk + done, got - done);
+			if (put < 0 && errno == EINTR){
+				put = 0;
+			}else if (put < 0){
+				break;
+			}
+		}
+	}
+	close(task->outFd);
+	task->outFd = -1;
+}
+
+/*****************************************************************
+* Function name : ulimitCmd / printLimit / applyLimits
+* Description :
+*	ulimit [-a]
+*	ulimit -t|-v|-n|-u [N | unlimited]
+*
+*	Shows or sets a resource limit for the commands the shell
+*	starts : CPU seconds, address space (KB), open files and user
+*	processes. A set limit is both the soft and the hard limit of
+*	the child, and can not go over the shell's own hard limit.
+*	The shell keeps its own limits, so a small
+*	-v or -u can never stop it from starting anything. With no
+*	option (or -a) every limit is listed.
+*
+*	applyLimits runs in the child between fork and exec and
+*	setrlimits whatever was set. posix_spawn has no such point,
+*	so commands are forked once any limit is set (limitsActive).
+*
+* Input  : args / l (index into limitTable), named
+* Output : 0, 1 if the limit can not be set, 2 on a usage error.
+*****************************************************************/
+int ulimitCmd(char* args[]){
+
+	struct rlimit current;
+	unsigned long long number;
+	char*  end;
+	rlim_t value;
+	int    l;
+
+	if (args[1] == NULL || (strEquals(args[1], "-a") == true && args[2] == NULL)){
+		for (l = 0; l < NUM_LIMITS; l++){
+			printLimit(l, true);
+		}
+		fflush(stdout);
+		return 0;
+	}
+	for (l = 0; l < NUM_LIMITS; l++){
+		if (args[1][0] == '-' && args[1][1] == limitTable[l].option && args[1][2] == '\0'){
+			break;
+		}
+	}
+	if (l == NUM_LIMITS || (args[2] != NULL && args[3] != NULL)){
+		printf("usage : ulimit [-a] | ulimit -t|-v|-n|-u [N | unlimited]\n");
+		fflush(stdout);
+		return 2;
+	}
+	if (args[2] == NULL){
+		printLimit(l, false);
+		fflush(stdout);
+		return 0;
+	}
+
+	if (strEquals(args[2], "unlimited") == true){
+		value = RLIM_INFINITY;
+	}else{
+		errno = 0;
+		number = strtoull(args[2], &end, 10);
+		//The scaled value has to fit in an rlim_t too.
+		if (end == args[2] || *end != '\0' || errno != 0 || args[2][0] == '-' ||
+		    number > RLIM_INFINITY / limitTable[l].scale){
+			printf("ulimit : %s : invalid number\n", args[2]);
+			fflush(stdout);
+			return 2;
+		}
+		value = number * limitTable[l].scale;
+	}
+	getrlimit(limitTable[l].resource, &current);
+	if (value > current.rlim_max){
+		printf("ulimit : %s : can not go over the hard limit\n", limitTable[l].name);
+		fflush(stdout);
+		return 1;
+	}
+	childLimits[l].rlim_cur = value;
+	childLimits[l].rlim_max = value;
+	limitSet[l] = true;
+	limitsActive = true;
+	return 0;
+}
+
+void printLimit(int l, bool named){
+
+	struct rlimit current;
+	char  unit[STRING_BUFFER];
+
+	if (limitSet[l] == true){
+		current = childLimits[l];
+	}else{
+		getrlimit(limitTable[l].resource, &current);
+	}
+	if (named == true){
+		if (limitTable[l].unit[0] != '\0'){
+			snprintf(unit, sizeof(unit), "(%s, -%c)", limitTable[l].unit, limitTable[l].option);
+		}else{
+			snprintf(unit, sizeof(unit), "(-%c)", limitTable[l].option);
+		}
+		printf("%-20s %-14s ", limitTable[l].name, unit);
+	}
+	if (current.rlim_cur == RLIM_INFINITY){
+		printf("unlimited\n");
+	}else{
+		printf("%llu\n", (unsigned long long)(current.rlim_cur / limitTable[l].scale));
+	}
+}
+
+void applyLimits(){
+
+	int l;
+
+	for (l = 0; l < NUM_LIMITS; l++){
+		if (limitSet[l] == true && setrlimit(limitTable[l].resource, &childLimits[l]) != 0){
+			perror("ulimit");
+			fflush(stdout);
+			exit(1);
+		}
+	}
+}
+
+/*****************************************************************
+* Function name : findBuiltin
+* Description :
+*	bsearch over builtinTable, which is sorted by name.
+*
+* Input  : name - first word of the command
+* Output : The table entry, or NULL if it is not built in.
+*****************************************************************/
+const struct builtin builtinTable[] = {
+	{ ":",      trueCmd,   true  },
+	{ "[",      testCmd,   true  },
+	{ "bench",  benchCmd,  true  },
+	{ "bg",     bgCmd,     false },
+	{ "break",  breakCmd,  false },
+	{ "cd",     cdCmd,     true  },
+	{ "continue", continueCmd, false },
+	{ "dirs",   dirsCmd,   true  },
+	{ "echo",   echoCmd,   true  },
+	{ "exit",   exitCmd,   false },
+	{ "false",  falseCmd,  true  },
+	{ "fg",     fgCmd,     false },
+	{ "hash",   hashCmd,   false },
+	{ "history", historyCmd, true },
+	{ "jobs",   jobsCmd,   false },
+	{ "kill",   killCmd,   false },
+	{ "parallel", parallelCmd, true  },
+	{ "popd",   popdCmd,   true  },
+	{ "printf", printfCmd, true  },
+	{ "pushd",  pushdCmd,  true  },
+	{ "pwd",    pwdCmd,    true  },
+	{ "return", returnCmd, false },
+	{ "status", statusCmd, false },
+	{ "test",   testCmd,   true  },
+	{ "true",   trueCmd,   true  },
+	{ "ulimit", ulimitCmd, false },
+	{ "wait",   waitCmd,   true  },
+};
+
+int compareBuiltin(const void* key, const void* entry){
+
+	return strcmp((const char*)key, ((const struct builtin*)entry)->name);
+}
+
+const struct builtin* findBuiltin(const char* name){
+
+	return bsearch(name, builtinTable, sizeof(builtinTable) / sizeof(builtinTable[0]),
+	               sizeof(struct builtin), compareBuiltin);
+}
+
+/*****************************************************************
+* Function name : runBuiltin
+* Description :
+*	Runs a built in inside the shell. If the command has any
+*	redirections they are opened as for any other command and
+*	applied to our own descriptors, after parking the originals
+*	on close-on-exec descriptors; once the built in returns,
+*	stdout is flushed and the originals are put back. No process
+*	is created at all.
+*
+*	A built in that returns BUILTIN_EXTERNAL ("kill" without a
+*	%job) is handed to progFork() after the descriptors are back.
+*
+* Input  : cmd, stage
+* Output : lastStatus, and exitTheChild for built ins that set
+*		   status
+*****************************************************************/
+void runBuiltin(const struct builtin* cmd, struct pipeStage* stage){
+
+	int  savedFds[REDIR_FD_LIMIT];
+	int  result;
+	bool background;
+	int fd, i;
+
+	if (stage->numRedirs > 0){
+		if (openRedirects(stage) == false){
+			if (cmd->setsStatus == true){
+				exitTheChild = 1 << 8;
+			}
+			lastStatus = 1;
+			return;
+		}
+		fflush(stdout);
+		//Park each descriptor we are about to replace (-1 : it was
+		// not open, so it is closed again afterwards).
+		for (fd = 0; fd < REDIR_FD_LIMIT; fd++){
+			savedFds[fd] = -2;
+		}
+		for (i = 0; i < stage->numRedirs; i++){
+			fd = stage->redirs[i].fd;
+			if (savedFds[fd] == -2){
+				savedFds[fd] = fcntl(fd, F_DUPFD_CLOEXEC, REDIR_FD_LIMIT);
+			}
+		}
+		applyRedirects(stage);
+		closeRedirects(stage);
+	}
+
+	result = cmd->run(stage->args);
+
+	if (stage->numRedirs > 0){
+		fflush(stdout);
+		for (fd = 0; fd < REDIR_FD_LIMIT; fd++){
+			if (savedFds[fd] >= 0){
+				dup2(savedFds[fd], fd);
+				close(savedFds[fd]);
+			}else if (savedFds[fd] == -1){
+				close(fd);
+			}
+		}
+	}
+
+	if (result == BUILTIN_EXTERNAL){
+		background = backgrFlag;
+		progFork();
+		lastStatus = (background == true) ? 0 : exitCode(exitTheChild);
+		return;
+	}
+	lastStatus = result & 0xff;
+	if (cmd->setsStatus == true){
+		exitTheChild = lastStatus << 8;
+	}
+}
+
+/*****************************************************************
+* Function name : statusCmd / cdCmd / exitCmd
+* Description :
+*	The three original built ins.
+*	  status : exit value of the last foreground command; with -v
+*	           also its wall time, CPU, peak RSS and context
+*	           switches
+*	  cd     : HOME with no argument, "cd -" the previous
+*	           directory, otherwise the argument (see changeDir).
+*	           1 if it fails, which status reports.
+*	  exit   : leave the main loop
+*
+* Input  : args
+* Output : exit code
+*****************************************************************/
+int statusCmd(char* args[]){
+
+	//Should change over the course of the execution of code
+	// at run time.
+	printf("exit value %d\n", WEXITSTATUS(exitTheChild));
+	if (args[1] != NULL && strEquals(args[1], "-v") == true){
+		if (lastUsageValid == true){
+			printUsage(stdout, "", lastWall, &lastUsage);
+		}else{
+			printf("no command has been run yet\n");
+		}
+	}
+	fflush(stdout);
+	return 0;
+}
+
+int cdCmd(char* args[]){
+
+	const char* dir = args[1];
+
+	if (dir == NULL){
+		dir = getenv("HOME");
+		if (dir == NULL){
+			fprintf(stderr, "cd : HOME not set\n");
+			return 1;
+		}
+	}else if (strEquals(dir, "-") == true){
+		if (oldPwd == NULL){
+			fprintf(stderr, "cd : OLDPWD not set\n");
+			return 1;
+		}
+		return (changeDir(oldPwd, true) == true) ? 0 : 1;
+	}
+	return (changeDir(dir, false) == true) ? 0 : 1;
+}
+
+int exitCmd(char* args[]){
+
+	//If an exit command is found we set the program's exit flag.
+	//ezpz
+	backgroundFlag = false;									
+	(void)args;
+	return 0;
+}
+
+/*****************************************************************
+* Function name : pushdCmd / popdCmd / dirsCmd / printDirs
+* Description :
+*	The directory stack, as in bash. The current directory is
+*	entry 0 and is not stored; dirStack holds the rest, top last.
+*	  pushd DIR : cd to DIR and push the directory we left
+*	  pushd     : swap the current directory with the top entry
+*	  popd      : cd to the top entry and drop it
+*	  dirs [-c] [-v] : print the stack (HOME shown as ~), -c
+*	              empties it, -v numbers the entries one per line
+*	pushd and popd print the stack afterwards (printDirs). 1 if the
+*	cd fails or there is nothing to swap / pop.
+*
+* Input  : args / verbose
+* Output : exit code
+*****************************************************************/
+int pushdCmd(char* args[]){
+
+	char* left = (logicalPwd != NULL) ? strdup(logicalPwd) : NULL;
+	char* top;
+
+	if (left == NULL){
+		fprintf(stderr, "pushd : current directory unknown\n");
+		return 1;
+	}
+	if (args[1] == NULL){
+		if (dirStackCount == 0){
+			fprintf(stderr, "pushd : no other directory\n");
+			free(left);
+			return 1;
+		}
+		top = dirStack[dirStackCount - 1];
+		if (changeDir(top, false) == false){
+			free(left);
+			return 1;
+		}
+		free(top);
+		dirStack[dirStackCount - 1] = left;
+	}else{
+		if (changeDir(args[1], false) == false){
+			free(left);
+			return 1;
+		}
+		if (dirStackCount == dirStackCap){
+			dirStackCap = (dirStackCap == 0) ? 8 : dirStackCap * 2;
+			dirStack = realloc(dirStack, dirStackCap * sizeof(char*));
+		}
+		dirStack[dirStackCount++] = left;
+	}
+	printDirs(false);
+	return 0;
+}
+
+int popdCmd(char* args[]){
+
+	(void)args;
+	if (dirStackCount == 0){
+		fprintf(stderr, "popd : directory stack empty\n");
+		return 1;
+	}
+	if (changeDir(dirStack[dirStackCount - 1], false) == false){
+		return 1;
+	}
+	free(dirStack[--dirStackCount]);
+	printDirs(false);
+	return 0;
+}
+
+int dirsCmd(char* args[]){
+
+	bool verbose = false;
+	int  i;
+
+	for (i = 1; args[i] != NULL; i++){
+		if (strEquals(args[i], "-c") == true){
+			while (dirStackCount > 0){
+				free(dirStack[--dirStackCount]);
+			}
+			return 0;
+		}else if (strEquals(args[i], "-v") == true){
+			verbose = true;
+		}else{
+			printf("usage : dirs [-c] [-v]\n");
+			fflush(stdout);
+			return 2;
+		}
+	}
+	printDirs(verbose);
+	return 0;
+}
+
+void printDirs(bool verbose){
+
+	const char* home = getenv("HOME");
+	const char* dir;
+	size_t homeLen = (home != NULL && strEquals(home, "/") == false) ? strlen(home) : 0;
+	int    i;
+
+	for (i = dirStackCount; i >= 0; i--){
+		dir = (i == dirStackCount) ? logicalPwd : dirStack[i];
+		if (dir == NULL){
+			dir = ".";
+		}
+		if (verbose == true){
+			printf("%2d  ", dirStackCount - i);
+		}else if (i != dirStackCount){
+			printf(" ");
+		}
+		if (homeLen > 0 && strncmp(dir, home, homeLen) == 0 && (dir[homeLen] == '/' || dir[homeLen] == '\0')){
+			printf("~%s", dir + homeLen);
+		}else{
+			printf("%s", dir);
+		}
+		if (verbose == true || i == 0){
+			printf("\n");
+		}
+	}
+	fflush(stdout);
+}
+
+/*****************************************************************
+* Function name : changeDir
+* Description :
+*	The one place the shell changes directory. A relative name
+*	that does not start with "." or ".." is looked up in CDPATH
+*	first (cdpathLookup). The new logical directory is worked out
+*	from $PWD and the name without asking the kernel; chdir() is
+*	then given the name itself, or the logical path when it has a
+*	".." in it, so "link/.." goes back where we came from as in sh.
+*	On success $OLDPWD and $PWD are updated; show (cd -, a CDPATH
+*	hit) prints the new directory.
+*
+* Input  : dir, show
+* Output : false after an error message if it could not be changed.
+*****************************************************************/
+bool changeDir(const char* dir, bool show){
+
+	const char* found = NULL;
+	const char* target = dir;
+	char* newPwd;
+	char* part;
+	bool  dotDot = false;
+
+	if (dir[0] == '\0'){
+		fprintf(stderr, "cd : empty directory name\n");
+		return false;
+	}
+	if (dir[0] != '/' && strncmp(dir, "./", 2) != 0 && strncmp(dir, "../", 3) != 0 &&
+	    strEquals(dir, ".") == false && strEquals(dir, "..") == false){
+		found = cdpathLookup(dir);
+	}
+	if (found != NULL){
+		target = found;
+		show = true;
+	}
+	for (part = strstr(target, ".."); part != NULL; part = strstr(part + 2, "..")){
+		if ((part == target || part[-1] == '/') && (part[2] == '/' || part[2] == '\0')){
+			dotDot = true;
+			break;
+		}
+	}
+
+	newPwd = logicalPath(target);
+	if (chdir((dotDot == true && newPwd != NULL) ? newPwd : target) != 0){
+		fflush(stdout);
+		fprintf(stderr, "cd : %s : %s\n", dir, strerror(errno));
+		free(newPwd);
+		return false;
+	}
+	//Nothing to go on (started in a removed directory) : ask once.
+	if (newPwd == NULL){
+		newPwd = getcwd(NULL, 0);
+	}
+
+	free(oldPwd);
+	oldPwd = logicalPwd;
+	logicalPwd = newPwd;
+	if (oldPwd != NULL){
+		setenv("OLDPWD", oldPwd, 1);
+	}
+	if (logicalPwd != NULL){
+		setenv("PWD", logicalPwd, 1);
+		if (show == true){
+			printf("%s\n", logicalPwd);
+			fflush(stdout);
+		}
+	}
+	return true;
+}
+
+/*****************************************************************
+* Function name : logicalPath
+* Description :
+*	dir made absolute against logicalPwd, with "." and empty parts
+*	dropped and each ".." taking off the part before it (never
+*	going above "/").
+*
+* Input  : dir
+* Output : A malloc'd path, or NULL if dir is relative and the
+*	current directory is not known.
+*****************************************************************/
+char* logicalPath(const char* dir){
+
+	const char* part = dir;
+	size_t partLen;
+	size_t used = 0;
+	char*  path;
+
+	if (dir[0] != '/' && logicalPwd == NULL){
+		return NULL;
+	}
+	path = malloc(((dir[0] == '/') ? 0 : strlen(logicalPwd)) + strlen(dir) + 2);
+	if (dir[0] != '/'){
+		used = strlen(logicalPwd);
+		memcpy(path, logicalPwd, used);
+		//"/" itself : no part yet.
+		if (used == 1){
+			used = 0;
+		}
+	}
+
+	while (*part != '\0'){
+		partLen = strcspn(part, "/");
+		if (partLen == 2 && part[0] == '.' && part[1] == '.'){
+			while (used > 0 && path[--used] != '/'){
+			}
+		}else if (partLen > 0 && (partLen != 1 || part[0] != '.')){
+			path[used++] = '/';
+			memcpy(path + used, part, partLen);
+			used += partLen;
+		}
+		part += partLen;
+		if (*part == '/'){
+			part++;
+		}
+	}
+	if (used == 0){
+		path[used++] = '/';
+	}
+	path[used] = '\0';
+	return path;
+}
+
+/*****************************************************************
+* Function name : cdpathLookup
+* Description :
+*	Finds name in the directories of CDPATH (an empty entry is the
+*	current directory). Hits under an absolute CDPATH entry are
+*	kept in cdHashTable, so a name is only searched for once per
+*	CDPATH value; a cached directory that has gone away is
+*	searched for again. A name found only in the current directory
+*	(or nowhere) gives NULL so the caller uses it as it is.
+*
+* Input  : name
+* Output : The directory, or NULL.
+*****************************************************************/
+const char* cdpathLookup(const char* name){
+
+	static char found[PATH_MAX];
+	const char* cdPath = lookupVar("CDPATH");
+	const char* dir;
+	const char* dirEnd;
+	struct hashEntry*  entry;
+	struct hashEntry** link;
+	struct stat info;
+	unsigned int bucket = hashName(name);
+	size_t dirLen;
+
+	if (cdPath == NULL || cdPath[0] == '\0'){
+		return NULL;
+	}
+	//CDPATH changed since we last looked : start over.
+	if (cdHashedPath == NULL || strEquals(cdHashedPath, cdPath) == false){
+		for (bucket = 0; bucket < HASH_BUCKETS; bucket++){
+			while ((entry = cdHashTable[bucket]) != NULL){
+				cdHashTable[bucket] = entry->next;
+				free(entry->name);
+				free(entry->path);
+				free(entry);
+			}
+		}
+		free(cdHashedPath);
+		cdHashedPath = strdup(cdPath);
+		bucket = hashName(name);
+	}
+
+	for (link = &cdHashTable[bucket]; (entry = *link) != NULL; link = &entry->next){
+		if (strEquals(entry->name, name) == true){
+			if (stat(entry->path, &info) == 0 && S_ISDIR(info.st_mode)){
+				entry->hits++;
+				return entry->path;
+			}
+			*link = entry->next;
+			free(entry->name);
+			free(entry->path);
+			free(entry);
+			break;
+		}
+	}
+
+	for (dir = cdPath; ; dir = dirEnd + 1){
+		dirEnd = strchr(dir, ':');
+		dirLen = (dirEnd != NULL) ? (size_t)(dirEnd - dir) : strlen(dir);
+		//The current directory is the caller's fallback anyway.
+		if (dirLen > 0 && (dirLen != 1 || dir[0] != '.')){
+			snprintf(found, sizeof(found), "%.*s/%s", (int)dirLen, dir, name);
+			if (stat(found, &info) == 0 && S_ISDIR(info.st_mode)){
+				if (found[0] != '/'){
+					return found;
+				}
+				entry = malloc(sizeof(struct hashEntry));
+				entry->name = strdup(name);
+				entry->path = strdup(found);
+				entry->hits = 1;
+				entry->next = cdHashTable[bucket];
+				cdHashTable[bucket] = entry;
+				return entry->path;
+			}
+		}else if (stat(name, &info) == 0 && S_ISDIR(info.st_mode)){
+			return NULL;
+		}
+		if (dirEnd == NULL){
+			return NULL;
+		}
+	}
+}
+
+/*****************************************************************
+* Function name : initPwd
+* Description :
+*	Startup : $PWD is kept if it is a clean absolute path that
+*	really names the directory we are in (same device and inode),
+*	so a path through a symlink stays as the user typed it;
+*	otherwise getcwd() fills it in once.
+*
+* Input  : None
+* Output : logicalPwd, $PWD
+*****************************************************************/
+void initPwd(){
+
+	const char* envPwd = getenv("PWD");
+	struct stat envInfo, dotInfo;
+
+	//Absolute, without "." or ".." parts, and really where we are.
+	if (envPwd != NULL && envPwd[0] == '/' && stat(envPwd, &envInfo) == 0 && stat(".", &dotInfo) == 0 &&
+	    envInfo.st_dev == dotInfo.st_dev && envInfo.st_ino == dotInfo.st_ino){
+		logicalPwd = logicalPath(envPwd);
+		if (strEquals(logicalPwd, envPwd) == false){
+			free(logicalPwd);
+			logicalPwd = NULL;
+		}
+	}
+	if (logicalPwd == NULL){
+		logicalPwd = getcwd(NULL, 0);
+	}
+	if (logicalPwd != NULL){
+		setenv("PWD", logicalPwd, 1);
+	}
+	oldPwd = (getenv("OLDPWD") != NULL) ? strdup(getenv("OLDPWD")) : NULL;
+}
+
+/*****************************************************************
+* Function name : killCmd
+* Description :
+*	"kill" is only ours when it names a %job; anything else runs
+*	the real kill program. ("kill -SIGTSTP $$" now really reaches
+*	us, since $$ is our own pid.)
+*
+* Input  : args
+* Output : 0, or BUILTIN_EXTERNAL
+*****************************************************************/
+int killCmd(char* args[]){
+
+	return (killJobCmd(args) == true) ? 0 : BUILTIN_EXTERNAL;
+}
+
+/*****************************************************************
+* Function name : breakCmd / continueCmd / returnCmd
+* Description :
+*	break [N] and continue [N] leave / restart the N'th enclosing
+*	loop (1 by default). return [N] leaves the function being run
+*	with exit code N (default : the last command's). They only
+*	set loopControl; the loops and callFunction() act on it.
+*
+* Input  : args
+* Output : exit code
+*****************************************************************/
+int breakCmd(char* args[]){
+
+	return loopJump(args, LOOP_BREAK);
+}
+
+int continueCmd(char* args[]){
+
+	return loopJump(args, LOOP_CONTINUE);
+}
+
+int loopJump(char* args[], int kind){
+
+	int levels = (args[1] != NULL) ? atoi(args[1]) : 1;
+
+	if (loopDepth == 0){
+		printf("%s : only meaningful in a loop\n", args[0]);
+		fflush(stdout);
+		return 1;
+	}
+	if (levels < 1){
+		printf("%s : %s : loop count out of range\n", args[0], args[1]);
+		fflush(stdout);
+		return 1;
+	}
+	loopControl = kind;
+	loopLevels = (levels > loopDepth) ? loopDepth : levels;
+	return 0;
+}
+
+int returnCmd(char* args[]){
+
+	if (functionDepth == 0){
+		printf("return : can only be used in a function\n");
+		fflush(stdout);
+		return 1;
+	}
+	loopControl = LOOP_RETURN;
+	return (args[1] != NULL) ? atoi(args[1]) : lastStatus;
+}
+
+/*****************************************************************
+* Function name : echoCmd
+* Description :
+*	echo [-neE] [word ...]. Words are written separated by one
+*	space and followed by a newline. -n drops the newline, -e
+*	turns on backslash escapes (\n, \t, \c, \0NNN, ...), -E turns
+*	them off again, like coreutils echo. Output goes through
+*	stdio, so in batch mode a run of echo lines costs no syscalls
+*	at all until the buffer fills.
+*
+* Input  : args
+* Output : 0
+*****************************************************************/
+int echoCmd(char* args[]){
+
+	bool newLine = true, escapes = false, stop = false;
+	const char* cursor;
+	int first, i;
+
+	for (i = 1; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0' &&
+	     strspn(args[i] + 1, "neE") == strlen(args[i] + 1); i++){
+		for (cursor = args[i] + 1; *cursor != '\0'; cursor++){
+			if (*cursor == 'n'){
+				newLine = false;
+			}else{
+				escapes = (*cursor == 'e');
+			}
+		}
+	}
+
+	for (first = i; args[i] != NULL && stop == false; i++){
+		if (i > first){
+			putchar(' ');
+		}
+		if (escapes == false){
+			fputs(args[i], stdout);
+			continue;
+		}
+		for (cursor = args[i]; *cursor != '\0' && stop == false; cursor++){
+			if (*cursor == '\\' && cursor[1] != '\0'){
+				cursor += putEscape(cursor + 1, true, &stop);
+			}else{
+				putchar(*cursor);
+			}
+		}
+	}
+	if (newLine == true && stop == false){
+		putchar('\n');
+	}
+	return 0;
+}
+
+/*****************************************************************
+* Function name : putEscape
+* Description :
+*	Writes one backslash escape. seq points just past the "\".
+*	echo -e and printf's %b want octal as \0NNN, a printf format
+*	wants \NNN; echoStyle picks which. \c sets stop.
+*
+* Input  : seq, echoStyle
+* Output : Number of characters used after the backslash, stop
+*****************************************************************/
+int putEscape(const char* seq, bool echoStyle, bool* stop){
+
+	int used = 1, value = 0, digits;
+	const char* octal = seq;
+
+	switch (*seq){
+		case 'a' : putchar('\a'); return 1;
+		case 'b' : putchar('\b'); return 1;
+		case 'e' : putchar(27);   return 1;
+		case 'f' : putchar('\f'); return 1;
+		case 'n' : putchar('\n'); return 1;
+		case 'r' : putchar('\r'); return 1;
+		case 't' : putchar('\t'); return 1;
+		case 'v' : putchar('\v'); return 1;
+		case '\\': putchar('\\'); return 1;
+		case 'c' : *stop = true;  return 1;
+	}
+
+	if (echoStyle == true && *seq == '0'){
+		octal = seq + 1;
+	}else if (echoStyle == true || *seq < '0' || *seq > '7'){
+		putchar('\\');
+		return 0;
+	}else{
+		used = 0;
+	}
+	for (digits = 0; digits < 3 && octal[digits] >= '0' && octal[digits] <= '7'; digits++){
+		value = value * 8 + (octal[digits] - '0');
+	}
+	putchar(value);
+	return used + digits;
+}
+
+/*****************************************************************
+* Function name : printfCmd
+* Description :
+*	printf FORMAT [argument ...]. Supports the usual conversions
+*	(d i u o x X c s b e f g E G and %%) with flags, width and
+*	precision, "*" widths included, plus backslash escapes in the
+*	format. Each conversion is handed to the C printf with the
+*	argument converted to the right type. As in coreutils, the
+*	format is reused while arguments are left over, and missing
+*	arguments count as "" or 0.
+*
+* Input  : args
+* Output : 0, 1 if a numeric argument was bad or no format given
+*****************************************************************/
+int printfCmd(char* args[]){
+
+	char   spec[STRING_BUFFER];
+	char** nextArg;
+	const char* format = args[1];
+	const char* cursor;
+	const char* arg;
+	size_t specLen;
+	bool   stop = false, usedArg;
+	int    status = 0, star;
+
+	if (format == NULL){
+		printf("printf : missing operand\n");
+		return 1;
+	}
+
+	nextArg = &args[2];
+	do{
+		usedArg = false;
+		for (cursor = format; *cursor != '\0' && stop == false; cursor++){
+			if (*cursor == '\\' && cursor[1] != '\0'){
+				cursor += putEscape(cursor + 1, false, &stop);
+				continue;
+			}
+			if (*cursor != '%'){
+				putchar(*cursor);
+				continue;
+			}
+			if (cursor[1] == '%'){
+				putchar('%');
+				cursor++;
+				continue;
+			}
+
+			//Copy "%[flags][width][.precision]" into spec, taking
+			// "*" values from the argument list.
+			specLen = 0;
+			spec[specLen++] = *cursor++;
+			while (*cursor != '\0' && strchr("-+ #0123456789.*", *cursor) != NULL &&
+			       specLen < sizeof(spec) - 8){
+				if (*cursor == '*'){
+					star = (*nextArg != NULL) ? (int)printfNumber(*nextArg++, &status) : 0;
+					usedArg = true;
+					specLen += snprintf(spec + specLen, sizeof(spec) - specLen, "%d", star);
+				}else{
+					spec[specLen++] = *cursor;
+				}
+				cursor++;
+			}
+			if (*cursor == '\0'){
+				printf("printf : missing conversion\n");
+				return 1;
+			}
+			arg = *nextArg;
+			if (arg != NULL){
+				nextArg++;
+				usedArg = true;
+			}
+
+			switch (*cursor){
+				case 'd' :
+				case 'i' :
+					memcpy(spec + specLen, "ll", 2);
+					spec[specLen + 2] = *cursor;
+					spec[specLen + 3] = '\0';
+					printf(spec, (arg != NULL) ? printfNumber(arg, &status) : 0LL);
+					break;
+				case 'u' :
+				case 'o' :
+				case 'x' :
+				case 'X' :
+					memcpy(spec + specLen, "ll", 2);
+					spec[specLen + 2] = *cursor;
+					spec[specLen + 3] = '\0';
+					printf(spec, (unsigned long long)((arg != NULL) ? printfNumber(arg, &status) : 0));
+					break;
+				case 'e' :
+				case 'E' :
+				case 'f' :
+				case 'F' :
+				case 'g' :
+				case 'G' :
+					spec[specLen] = *cursor;
+					spec[specLen + 1] = '\0';
+					printf(spec, (arg != NULL) ? strtod(arg, NULL) : 0.0);
+					break;
+				case 'c' :
+					spec[specLen] = 'c';
+					spec[specLen + 1] = '\0';
+					if (arg != NULL && arg[0] != '\0'){
+						printf(spec, arg[0]);
+					}
+					break;
+				case 's' :
+					spec[specLen] = 's';
+					spec[specLen + 1] = '\0';
+					printf(spec, (arg != NULL) ? arg : "");
+					break;
+				case 'b' :
+					for (; arg != NULL && *arg != '\0' && stop == false; arg++){
+						if (*arg == '\\' && arg[1] != '\0'){
+							arg += putEscape(arg + 1, true, &stop);
+						}else{
+							putchar(*arg);
+						}
+					}
+					break;
+				default :
+					printf("printf : %%%c : invalid conversion\n", *cursor);
+					return 1;
+			}
+		}
+	}while (usedArg == true && *nextArg != NULL && stop == false);
+
+	return status;
+}
+
+/*****************************************************************
+* Function name : printfNumber
+* Description :
+*	Numeric printf argument. Accepts decimal, 0x hex and 0 octal,
+*	and 'c / "c for the value of a character like POSIX says.
+*
+* Input  : arg
+* Output : The value. status becomes 1 for junk.
+*****************************************************************/
+long long printfNumber(const char* arg, int* status){
+
+	char* end;
+	long long value;
+
+	if (arg[0] == '\'' || arg[0] == '"'){
+		return (unsigned char)arg[1];
+	}
+	errno = 0;
+	value = strtoll(arg, &end, 0);
+	if (end == arg || *end != '\0' || errno != 0){
+		printf("printf : %s : expected a numeric value\n", arg);
+		*status = 1;
+	}
+	return value;
+}
+
+/*****************************************************************
+* Function name : pwdCmd / trueCmd / falseCmd
+* Description :
+*	pwd prints the current directory : $PWD as cd keeps it, or
+*	with -P what the kernel says (getcwd). true (and ":") succeed,
+*	false fails; neither needs a process anymore.
+*
+* Input  : args
+* Output : exit code
+*****************************************************************/
+int pwdCmd(char* args[]){
+
+	char* physical;
+
+	if (logicalPwd != NULL && (args[1] == NULL || strEquals(args[1], "-P") == false)){
+		puts(logicalPwd);
+		return 0;
+	}
+	physical = getcwd(NULL, 0);
+	if (physical == NULL){
+		perror("pwd");
+		return 1;
+	}
+	puts(physical);
+	free(physical);
+	return 0;
+}
+
+int trueCmd(char* args[]){
+
+	(void)args;
+	return 0;
+}
+
+int falseCmd(char* args[]){
+
+	(void)args;
+	return 1;
+}
+
+/*****************************************************************
+* Function name : testCmd
+* Description :
+*	test EXPRESSION and [ EXPRESSION ]. A small recursive
+*	descent parser over the arguments :
+*	  or      : and { -o and }
+*	  and     : not { -a not }
+*	  not     : ! not | primary
+*	  primary : ( or ) | STRING OP STRING | -X ARG | STRING
+*	with the usual file tests (-e -f -d -r -w -x -s -L -h -b -c
+*	-p -S), string tests (-z -n = == != < >), integer tests (-eq
+*	-ne -lt -le -gt -ge) and -nt / -ot.
+*
+* Input  : args
+* Output : 0 true, 1 false, 2 for a malformed expression
+*****************************************************************/
+int testCmd(char* args[]){
+
+	int  argCount;
+	bool result;
+
+	for (argCount = 0; args[argCount] != NULL; argCount++){
+	}
+	if (strEquals(args[0], "[") == true){
+		if (strEquals(args[argCount - 1], "]") == false){
+			printf("[ : missing ']'\n");
+			return 2;
+		}
+		argCount--;
+	}
+
+	testArgs = args + 1;
+	testCount = argCount - 1;
+	testPos = 0;
+	testError = false;
+	if (testCount == 0){
+		return 1;
+	}
+
+	result = testOr();
+	if (testError == false && testPos != testCount){
+		printf("%s : unexpected argument '%s'\n", args[0], testArgs[testPos]);
+		testError = true;
+	}
+	if (testError == true){
+		return 2;
+	}
+	return (result == true) ? 0 : 1;
+}
+
+bool testOr(){
+
+	bool result = testAnd();
+
+	while (testPos < testCount && strEquals(testArgs[testPos], "-o") == true){
+		testPos++;
+		result = testAnd() || result;
+	}
+	return result;
+}
+
+bool testAnd(){
+
+	bool result = testNot();
+
+	while (testPos < testCount && strEquals(testArgs[testPos], "-a") == true){
+		testPos++;
+		result = testNot() && result;
+	}
+	return result;
+}
+
+bool testNot(){
+
+	if (testPos < testCount - 1 && strEquals(testArgs[testPos], "!") == true){
+		testPos++;
+		return !testNot();
+	}
+	return testPrimary();
+}
+
+bool testPrimary(){
+
+	const char* word;
+	bool result;
+
+	if (testPos >= testCount){
+		printf("test : argument expected\n");
+		testError = true;
+		return false;
+	}
+	word = testArgs[testPos];
+
+	//STRING OP STRING is checked first so "-n = -n" compares.
+	if (testPos + 3 <= testCount){
+		const char* op = testArgs[testPos + 1];
+		if (strEquals(op, "=") || strEquals(op, "==") || strEquals(op, "!=") ||
+		    strEquals(op, "<") || strEquals(op, ">") ||
+		    (op[0] == '-' && strlen(op) == 3 && strstr("-eq-ne-lt-le-gt-ge-nt-ot", op) != NULL)){
+			testPos += 3;
+			return testBinary(word, op, testArgs[testPos - 1]);
+		}
+	}
+	if (strEquals(word, "(") == true){
+		testPos++;
+		result = testOr();
+		if (testPos >= testCount || strEquals(testArgs[testPos], ")") == false){
+			printf("test : missing ')'\n");
+			testError = true;
+			return false;
+		}
+		testPos++;
+		return result;
+	}
+	if (word[0] == '-' && word[1] != '\0' && word[2] == '\0' && testPos + 1 < testCount &&
+	    strchr("efdrwxsLhbcpSznt", word[1]) != NULL){
+		testPos += 2;
+		return testUnary(word, testArgs[testPos - 1]);
+	}
+	testPos++;
+	return word[0] != '\0';
+}
+
+/*****************************************************************
+* Function name : testUnary / testBinary / testInteger
+* Description :
+*	The individual tests behind testPrimary(). File tests use
+*	stat (lstat for -L/-h) and access for -r/-w/-x.
+*
+* Input  : operator and operands
+* Output : Result of the test. testError for a bad integer.
+*****************************************************************/
+bool testUnary(const char* op, const char* arg){
+
+	struct stat info;
+	bool exists;
+
+	switch (op[1]){
+		case 'z' : return arg[0] == '\0';
+		case 'n' : return arg[0] != '\0';
+		case 't' : return isatty((int)testInteger(arg));
+		case 'r' : return access(arg, R_OK) == 0;
+		case 'w' : return access(arg, W_OK) == 0;
+		case 'x' : return access(arg, X_OK) == 0;
+		case 'L' :
+		case 'h' : return lstat(arg, &info) == 0 && S_ISLNK(info.st_mode);
+	}
+	exists = (stat(arg, &info) == 0);
+	switch (op[1]){
+		case 'e' : return exists;
+		case 'f' : return exists && S_ISREG(info.st_mode);
+		case 'd' : return exists && S_ISDIR(info.st_mode);
+		case 's' : return exists && info.st_size > 0;
+		case 'b' : return exists && S_ISBLK(info.st_mode);
+		case 'c' : return exists && S_ISCHR(info.st_mode);
+		case 'p' : return exists && S_ISFIFO(info.st_mode);
+		case 'S' : return exists && S_ISSOCK(info.st_mode);
+	}
+	return false;
+}
+
+bool testBinary(const char* left, const char* op, const char* right){
+
+	struct stat leftInfo, rightInfo;
+	bool leftOk, rightOk;
+
+	if (strEquals(op, "=") == true || strEquals(op, "==") == true){
+		return strEquals(left, right);
+	}
+	if (strEquals(op, "!=") == true){
+		return !strEquals(left, right);
+	}
+	if (strEquals(op, "<") == true){
+		return strcmp(left, right) < 0;
+	}
+	if (strEquals(op, ">") == true){
+		return strcmp(left, right) > 0;
+	}
+	if (strEquals(op, "-nt") == true || strEquals(op, "-ot") == true){
+		leftOk = (stat(left, &leftInfo) == 0);
+		rightOk = (stat(right, &rightInfo) == 0);
+		if (op[1] == 'o'){
+			return rightOk && (!leftOk || leftInfo.st_mtime < rightInfo.st_mtime);
+		}
+		return leftOk && (!rightOk || leftInfo.st_mtime > rightInfo.st_mtime);
+	}
+
+	long long leftNum = testInteger(left);
+	long long rightNum = testInteger(right);
+	switch (op[1] * 256 + op[2]){
+		case 'e' * 256 + 'q' : return leftNum == rightNum;
+		case 'n' * 256 + 'e' : return leftNum != rightNum;
+		case 'l' * 256 + 't' : return leftNum <  rightNum;
+		case 'l' * 256 + 'e' : return leftNum <= rightNum;
+		case 'g' * 256 + 't' : return leftNum >  rightNum;
+		case 'g' * 256 + 'e' : return leftNum >= rightNum;
+	}
+	return false;
+}
+
+long long testInteger(const char* arg){
+
+	char* end;
+	long long value;
+
+	errno = 0;
+	value = strtoll(arg, &end, 10);
+	if (end == arg || *end != '\0' || errno != 0){
+		printf("test : %s : integer expression expected\n", arg);
+		testError = true;
+	}
+	return value;
+}
+
+/*****************************************************************
+*
+* Function name : catchSIGCHLD
+*
+* Description   :
+*	SIGCHLD handler. All it does is write one byte into the self
+*	pipe so the main loop knows something has finished; the
+*	actual reaping happens in reapChildren() where it is safe to
+*	call non re-entrant functions. errno is saved because the
+*	handler can interrupt code that is about to look at it.
+*
+* inputs       : signo (unused)
+* outputs      : None
+*
+*****************************************************************/
+void catchSIGCHLD(int signo){
+
+	int savedErrno = errno;
+	char wake = 1;
+
+	(void)signo;
+	write(childPipe[1], &wake, 1);
+	errno = savedErrno;
+}
+
+/*****************************************************************
+*
+* Function name : reapChildren
+*
+* Description   :
+*	Collects every child that has exited since the last call.
+*	If the self pipe is empty no SIGCHLD has come in and there
+*	is nothing to do, so the common case costs one read().
+*	Otherwise wait4(-1, WNOHANG) is called until it runs dry,
+*	which is O(number finished) no matter how many background
+*	jobs are still running.
+*
+*	Each one goes through collectChild(), which finds tracked
+*	background jobs through the pid hash of the job table, marks
+*	them done and queues them for processTracker(). Anything else
+*	(earlier stages of a background pipeline) is just reaped. With
+*	job control, jobs that get stopped (a background job reading
+*	the terminal, say) are queued the same way, and ones continued
+*	by something else are running again.
+*
+*	Only called from safe points, never while a foreground
+*	command is being waited on, so it can not steal its status.
+*
+* inputs       : None
+* outputs      : None
+*
+*****************************************************************/
+void reapChildren(){
+
+	char drain[64];
+	bool woken = false;
+	int childStatus;
+	pid_t donePid;
+	struct rusage usage;
+
+	while (read(childPipe[0], drain, sizeof(drain)) > 0){
+		woken = true;
+	}
+	if (woken == false){
+		return;
+	}
+
+	while ((donePid = wait4(-1, &childStatus, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0){
+		collectChild(donePid, childStatus, &usage);
+	}
+}
+
+/*****************************************************************
+*
+* Function name : collectChild
+*
+* Description : The job table side of reaping one child : what
+*               wait4 said about donePid is applied to its job, if
+*               it is a tracked one. Also used by "parallel", which
+*               reaps for itself while it runs.
+*
+* inputs       : donePid, childStatus, usage
+* outputs      : None
+*
+*****************************************************************/
+void collectChild(pid_t donePid, int childStatus, const struct rusage* usage){
+
+	struct job* doneJob = findJobByPid(donePid);
+
+	if (doneJob == NULL){
+		return;
+	}
+	if (WIFSTOPPED(childStatus)){
+		if (doneJob->state == JOB_RUNNING){
+			doneJob->state = JOB_STOPPED;
+			runningJobs--;
+			queueCompletion(doneJob);
+		}
+	}else if (WIFCONTINUED(childStatus)){
+		if (doneJob->state == JOB_STOPPED){
+			doneJob->state = JOB_RUNNING;
+			runningJobs++;
+		}
+	}else{
+		finishJob(doneJob, childStatus, usage);
+		queueCompletion(doneJob);
+	}
+}
+
+/*****************************************************************
+*
+* Function name : queueCompletion
+*
+* Description : Adds a finished background job to doneQueue, growing
+*               it when needed.
+*
+* inputs       : doneJob
+* outputs      : None
+*
+*****************************************************************/
+void queueCompletion(struct job* doneJob){
+
+	if (doneCount == doneCapacity){
+		doneCapacity = (doneCapacity == 0) ? 16 : doneCapacity * 2;
+		doneQueue = realloc(doneQueue, doneCapacity * sizeof(struct completion));
+	}
+	doneQueue[doneCount].id = doneJob->id;
+	doneQueue[doneCount].pid = doneJob->pid;
+	doneCount++;
+}
+
+/*****************************************************************
+*
+* Function nmae : processtracker()
+*
+* Description   :
+*	This is the process tracker. It runs just before the prompt
+*	is printed, and from readPromptLine() whenever a child exits
+*	while the prompt is up; those are the safe points for telling
+*	the user about background jobs. It reaps whatever SIGCHLD told us
+*	about and then prints every queued completion : the pid,
+*	either the exit value or the terminating signal, and what
+*	the process used (wall time, CPU, peak RSS, context switches). The job
+*	slot is given back once it has been reported. A job that has
+*	stopped is reported as such and stays in the table. Jobs that
+*	"wait" already collected are gone from the table and are
+*	skipped.
+*
+*	Background statuses are kept local; exitTheChild belongs to
+*	the last foreground command and status must not see these.
+*
+* inputs       : None
+*
+* outputs      : Print statements based on the background process ID
+*				 and the exit value or signal it finished with.
+*				 true if anything was printed.
+*
+*****************************************************************/
+bool processTracker(){
+
+	struct job* doneJob;
+	bool printed = false;
+	int i;
+
+	reapChildren();
+	for (i = 0; i < doneCount; i++){
+		doneJob = findJobById(doneQueue[i].id);
+		if (doneJob == NULL || doneJob->pid != doneQueue[i].pid || doneJob->state == JOB_RUNNING){
+			continue;
+		}
+		if (doneJob->state == JOB_STOPPED){
+			printf("\n[%d] Stopped   %s\n", doneJob->id, doneJob->cmdLine);
+			printed = true;
+			continue;
+		}
+		printf("\n");
+		printf("______________________________________\n");
+		printf("| [%d] background pid for the process : %d \n", doneJob->id, doneJob->pid);
+		if (WIFSIGNALED(doneJob->status)){
+			printf("| process was terminated by signal : %d \n", WTERMSIG(doneJob->status));
+		}else{
+			setExStatus = WEXITSTATUS(doneJob->status);
+			printf("| exit value for that process : %d \n", setExStatus);
+		}
+		printUsage(stdout, "| ", doneJob->wallSeconds, &doneJob->usage);
+		printf("|_____________________________________| \n");
+		removeJob(doneJob);
+		printed = true;
+	}
+	if (printed == true){
+		fflush(stdout);
+	}
+	doneCount = 0;
+	return printed;
+}
+
+/*****************************************************************
+*
+* Function name : addJob
+*
+*
+* Description   :
+*			Registers a background job. The slot (and with it the
+*			job number) comes off the free list when there is one,
+*			otherwise the slot array grows by doubling. The job is
+*			also chained into the pid hash, which doubles whenever
+*			it gets as many jobs as buckets so chains stay short.
+*
+* Input  : pid to track, its process group (0 = none of its own),
+*		   the command line to show in "jobs"
+*
+* Output : The new job.
+*
+*****************************************************************/
+struct job* addJob(pid_t pid, pid_t pgid, const char* cmdLine){
+
+	struct job* newJob = malloc(sizeof(struct job));
+	int slot;
+
+	if (freeSlotCount > 0){
+		slot = freeSlots[--freeSlotCount];
+	}else{
+		if (jobSlotCount == jobSlotCapacity){
+			jobSlotCapacity = (jobSlotCapacity == 0) ? 16 : jobSlotCapacity * 2;
+			jobSlots = realloc(jobSlots, jobSlotCapacity * sizeof(struct job*));
+			freeSlots = realloc(freeSlots, jobSlotCapacity * sizeof(int));
+		}
+		slot = jobSlotCount++;
+	}
+
+	newJob->id = slot + 1;
+	newJob->pid = pid;
+	newJob->pgid = pgid;
+	newJob->cmdLine = strdup(cmdLine);
+	newJob->started = time(NULL);
+	clock_gettime(CLOCK_MONOTONIC, &newJob->startMono);
+	newJob->state = JOB_RUNNING;
+	newJob->status = 0;
+	memset(&newJob->usage, 0, sizeof(newJob->usage));
+	newJob->wallSeconds = 0;
+	jobSlots[slot] = newJob;
+
+	if (liveJobs >= pidBuckets){
+		growPidBuckets();
+	}
+	newJob->pidNext = jobsByPid[pid % pidBuckets];
+	jobsByPid[pid % pidBuckets] = newJob;
+	liveJobs++;
+	runningJobs++;
+	return newJob;
+}
+
+/*****************************************************************
+*
+* Function name : growPidBuckets
+*
+* Description : Doubles the pid hash (64 buckets to start with) and
+*               rechains every live job into it.
+*
+* Input  : None
+* Output : None
+*
+*****************************************************************/
+void growPidBuckets(){
+
+	int newBuckets = (pidBuckets == 0) ? 64 : pidBuckets * 2;
+	struct job** newTable = calloc(newBuckets, sizeof(struct job*));
+	struct job* entry;
+	int i;
+
+	for (i = 0; i < jobSlotCount; i++){
+		entry = jobSlots[i];
+		if (entry != NULL){
+			entry->pidNext = newTable[entry->pid % newBuckets];
+			newTable[entry->pid % newBuckets] = entry;
+		}
+	}
+	free(jobsByPid);
+	jobsByPid = newTable;
+	pidBuckets = newBuckets;
+}
+
+/*****************************************************************
+*
+* Function name : findJobByPid / findJobById
+*
+* Description : O(1) job lookups, through the pid hash or straight
+*               into the slot array.
+*
+* Input  : pid or job number
+* Output : The job, or NULL.
+*
+*****************************************************************/
+struct job* findJobByPid(pid_t pid){
+
+	struct job* entry;
+
+	if (pidBuckets == 0){
+		return NULL;
+	}
+	for (entry = jobsByPid[pid % pidBuckets]; entry != NULL; entry = entry->pidNext){
+		if (entry->pid == pid){
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+struct job* findJobById(int id){
+
+	if (id < 1 || id > jobSlotCount){
+		return NULL;
+	}
+	return jobSlots[id - 1];
+}
+
+/*****************************************************************
+*
+* Function name : findJobArg
+*
+* Description : Turns a "%n" or pid argument into a job.
+*
+* Input  : arg
+* Output : The job, or NULL.
+*
+*****************************************************************/
+struct job* findJobArg(const char* arg){
+
+	if (arg[0] == '%'){
+		return findJobById(atoi(arg + 1));
+	}
+	return findJobByPid(atoi(arg));
+}
+
+/*****************************************************************
+*
+* Function name : finishJob
+*
+* Description : Marks a job as done with the status and resource
+*               use wait4 gave us, and how long it ran. The time is
+*               taken when the shell collects it, which at an idle
+*               prompt is as soon as it exits, but in a script only
+*               at the next line.
+*
+* Input  : doneJob, status, usage
+* Output : None
+*
+*****************************************************************/
+void finishJob(struct job* doneJob, int status, const struct rusage* usage){
+
+	if (doneJob->state == JOB_RUNNING){
+		runningJobs--;
+	}
+	doneJob->state = JOB_DONE;
+	doneJob->status = status;
+	doneJob->usage = *usage;
+	doneJob->wallSeconds = secondsSince(&doneJob->startMono);
+}
+
+/*****************************************************************
+*
+* Function name : removeJob
+*
+* Description : Takes a job out of the pid hash, frees it and puts
+*               its slot on the free list.
+*
+* Input  : oldJob
+* Output : None
+*
+*****************************************************************/
+void removeJob(struct job* oldJob){
+
+	struct job** link = &jobsByPid[oldJob->pid % pidBuckets];
+
+	while (*link != oldJob){
+		link = &(*link)->pidNext;
+	}
+	*link = oldJob->pidNext;
+
+	if (oldJob->state == JOB_RUNNING){
+		runningJobs--;
+	}
+	jobSlots[oldJob->id - 1] = NULL;
+	freeSlots[freeSlotCount++] = oldJob->id - 1;
+	liveJobs--;
+	free(oldJob->cmdLine);
+	free(oldJob);
+}
+
+/*****************************************************************
+*
+* Function name : jobsCmd
+*
+* Description : The "jobs" built in. Lists every job still in the
+*               table with its number, state (Running, Stopped or
+*               Done), pid, start time, how
+*               long it has been going and its command line.
+*
+* Input  : args (unused)
+* Output : One line per job.
+*
+*****************************************************************/
+int jobsCmd(char* args[]){
+
+	struct timespec now;
+	struct job* entry;
+	char startStr[16];
+	int i;
+
+	reapChildren();
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (i = 0; i < jobSlotCount; i++){
+		entry = jobSlots[i];
+		if (entry == NULL){
+			continue;
+		}
+		strftime(startStr, sizeof(startStr), "%H:%M:%S", localtime(&entry->started));
+		printf("[%d] %-8s pid %-7d started %s (%lds)  %s\n", entry->id,
+		       (entry->state == JOB_RUNNING) ? "Running" : (entry->state == JOB_STOPPED) ? "Stopped" : "Done",
+		       entry->pid, startStr,
+		       (long)(now.tv_sec - entry->startMono.tv_sec), entry->cmdLine);
+	}
+	(void)args;
+	fflush(stdout);
+	return 0;
+}
+
+/*****************************************************************
+*
+* Function name : waitCmd
+*
+*
+* Description   :
+*			The "wait" built in.
+*			  wait         : block until every background job is
+*							 done
+*			  wait %n|pid  : block until that job is done
+*
+*			Jobs collected here are not announced at the prompt
+*			afterwards. A stopped job is not waited for : "wait %n"
+*			says so and leaves it in the table, and a job that
+*			stops while we wait (WUNTRACED) goes back into the
+*			table as stopped, to be picked up with fg / bg.
+*
+* Input  : args - the command's arguments
+* Output : The exit code of the last job waited for (0 if there
+*		   was none), 127 (after a message) for a job that does not
+*		   exist, 1 for a stopped one. runBuiltin() passes it on to
+*		   $?, && / || and status.
+*
+*****************************************************************/
+int waitCmd(char* args[]){
+
+	struct job* waitJob;
+	struct rusage usage;
+	int   childStatus;
+	int   result = 0;
+	pid_t donePid;
+	int   i;
+
+	if (args[1] == NULL){
+		while (runningJobs > 0){
+			donePid = wait4(-1, &childStatus, WUNTRACED, &usage);
+			if (donePid < 0 && errno == EINTR){
+				continue;
+			}
+			if (donePid < 0){
+				break;
+			}
+			waitJob = findJobByPid(donePid);
+			if (waitJob == NULL){
+				continue;
+			}
+			if (WIFSTOPPED(childStatus)){
+				collectChild(donePid, childStatus, &usage);
+				continue;
+			}
+			finishJob(waitJob, childStatus, &usage);
+			result = exitCode(childStatus);
+			removeJob(waitJob);
+		}
+		return result;
+	}
+
+	for (i = 1; args[i] != NULL; i++){
+		waitJob = findJobArg(args[i]);
+		if (waitJob == NULL){
+			printf("wait : %s : no such job\n", args[i]);
+			fflush(stdout);
+			result = 127;
+			continue;
+		}
+		if (waitJob->state == JOB_RUNNING){
+			while (wait4(waitJob->pid, &childStatus, WUNTRACED, &usage) < 0 && errno == EINTR){
+			}
+			if (WIFSTOPPED(childStatus)){
+				collectChild(waitJob->pid, childStatus, &usage);
+			}else{
+				finishJob(waitJob, childStatus, &usage);
+			}
+		}
+		if (waitJob->state == JOB_STOPPED){
+			printf("wait : %s : job is stopped\n", args[i]);
+			fflush(stdout);
+			result = 1;
+			continue;
+		}
+		result = exitCode(waitJob->status);
+		removeJob(waitJob);
+	}
+	return result;
+}
+
+/*****************************************************************
+*
+* Function name : fgCmd / bgCmd
+*
+*
+* Description   :
+*			fg [%n|pid] : puts a job back in the foreground. It
+*						  gets the terminal and a SIGCONT, and the
+*						  shell waits for it like any foreground
+*						  command; ^Z stops it again.
+*			bg [%n|pid] : lets a stopped job carry on in the
+*						  background.
+*			With no argument, the highest numbered job that is
+*			not done is used.
+*
+* Input  : args - the command's arguments
+* Output : fg : the job's exit code. bg : 0. 1 if there is no
+*		   such job.
+*
+*****************************************************************/
+struct job* pickJob(char* args[]){
+
+	struct job* target = NULL;
+	int i;
+
+	reapChildren();
+	if (args[1] != NULL){
+		target = findJobArg(args[1]);
+	}else{
+		for (i = jobSlotCount - 1; i >= 0 && target == NULL; i--){
+			if (jobSlots[i] != NULL && jobSlots[i]->state != JOB_DONE){
+				target = jobSlots[i];
+			}
+		}
+	}
+	if (target == NULL || target->state == JOB_DONE){
+		printf("%s : %s : no such job\n", args[0], (args[1] != NULL) ? args[1] : "current");
+		fflush(stdout);
+		return NULL;
+	}
+	return target;
+}
+
+int fgCmd(char* args[]){
+
+	struct job* target = pickJob(args);
+
+	if (target == NULL){
+		return 1;
+	}
+	printf("%s\n", target->cmdLine);
+	fflush(stdout);
+	if (target->state == JOB_STOPPED){
+		target->state = JOB_RUNNING;
+		runningJobs++;
+	}
+	kill((target->pgid > 0) ? -target->pgid : target->pid, SIGCONT);
+
+	clock_gettime(CLOCK_MONOTONIC, &commandStart);
+	if (waitForegroundJob(&target->pid, 1, target->pgid, &exitTheChild, target) == false){
+		removeJob(target);
+	}
+	return exitCode(exitTheChild);
+}
+
+int bgCmd(char* args[]){
+
+	struct job* target = pickJob(args);
+
+	if (target == NULL){
+		return 1;
+	}
+	if (target->state == JOB_STOPPED){
+		target->state = JOB_RUNNING;
+		runningJobs++;
+	}
+	kill((target->pgid > 0) ? -target->pgid : target->pid, SIGCONT);
+	printf("[%d] %s &\n", target->id, target->cmdLine);
+	fflush(stdout);
+	return 0;
+}
+
+/*****************************************************************
+*
+* Function name : killJobCmd
+*
+*
+* Description   :
+*			"kill" for job numbers : kill [-SIG | -s SIG] %n ...
+*			A job with its own process group (a pipeline) gets the
+*			signal sent to the whole group. A stopped job is sent a
+*			SIGCONT after it so the signal is acted on. Plain pids
+*			in the same line are passed to kill() as they are.
+*
+* Input  : args - the command's arguments
+*
+* Output : false when the line has no %job in it, so the caller runs
+*		   the real kill program instead.
+*
+*****************************************************************/
+bool killJobCmd(char* args[]){
+
+	struct job* target;
+	char* arg;
+	int   signo = SIGTERM;
+	int   i;
+
+	for (i = 1; args[i] != NULL && args[i][0] != '%'; i++){
+	}
+	if (args[i] == NULL){
+		return false;
+	}
+
+	for (i = 1; (arg = args[i]) != NULL; i++){
+		if (strEquals(arg, "-s") == true){
+			arg = args[++i];
+			signo = (arg != NULL) ? parseSignal(arg) : -1;
+			if (arg == NULL){
+				i--;
+			}
+		}else if (arg[0] == '-'){
+			signo = parseSignal(arg + 1);
+		}else if (arg[0] == '%'){
+			target = findJobArg(arg);
+			if (target == NULL || target->state == JOB_DONE){
+				printf("kill : %s : no such job\n", arg);
+				fflush(stdout);
+				continue;
+			}
+			if (kill((target->pgid > 0) ? -target->pgid : target->pid, signo) < 0){
+				perror("kill");
+			}else if (target->state == JOB_STOPPED && signo > 0 && signo != SIGSTOP){
+				kill((target->pgid > 0) ? -target->pgid : target->pid, SIGCONT);
+			}
+		}else if (kill(atoi(arg), signo) < 0){
+			perror("kill");
+		}
+		if (signo < 0){
+			printf("kill : invalid signal\n");
+			fflush(stdout);
+			return true;
+		}
+	}
+	return true;
+}
+
+/*****************************************************************
+*
+* Function name : parseSignal
+*
+* Description : Signal number from "9", "KILL" or "SIGKILL".
+*
+* Input  : name
+* Output : Signal number, -1 if it is not one.
+*
+*****************************************************************/
+int parseSignal(const char* name){
+
+	const char* abbrev;
+	int signo;
+
+	if (name[0] >= '0' && name[0] <= '9'){
+		return atoi(name);
+	}
+	if (strncmp(name, "SIG", 3) == 0){
+		name += 3;
+	}
+	for (signo = 1; signo < NSIG; signo++){
+		abbrev = sigabbrev_np(signo);
+		if (abbrev != NULL && strEquals(abbrev, name) == true){
+			return signo;
+		}
+	}
+	return -1;
+}
+
+
+/*****************************************************************
+*
+* Function name : waitForeground
+*
+* Description : wait4 for a foreground child that keeps going when
+*               a signal handler (SIGTSTP) interrupts the wait.
+*
+* inputs       : pid
+* outputs      : status, usage
+*
+*****************************************************************/
+void waitForeground(pid_t pid, int* status, struct rusage* usage){
+
+	while (wait4(pid, status, 0, usage) < 0 && errno == EINTR){
+	}
+	if (WIFSIGNALED(*status) && WTERMSIG(*status) == SIGINT){
+		lineInterrupted = true;
+	}
+}
+
+/*****************************************************************
+*
+* Function name : waitForegroundJob
+*
+* Description : Waits for a foreground command : the stages of a
+*               pipeline, or one process. pgid is its process group
+*               (0 : it shares the shell's), which gets the terminal
+*               for the duration.
+*
+*               The stages' resource use (wait4) is added up into
+*               lastUsage, with the time since commandStart, and into
+*               usageSink when "time" is running.
+*
+*               Under "timeout" each wait4 is preceded by
+*               waitDeadline(), which ends the job if it runs past
+*               the deadline.
+*
+*               With job control a ^Z stops the job instead of the
+*               shell; the wait then ends, the job is put in the
+*               table as stopped (fgJob when it is already there,
+*               from "fg") and status reads as 128 + the signal.
+*
+* inputs       : pids, count, pgid, fgJob (NULL for a new command)
+* outputs      : status (of the last stage). true if it stopped.
+*
+*****************************************************************/
+bool waitForegroundJob(pid_t* pids, int count, pid_t pgid, int* status, struct job* fgJob){
+
+	char  jobLine[MAXIMUM_NUM_CHARACTERS];
+	struct rusage stageUsage;
+	bool  handedOver = giveTerminal(pgid);
+	bool  stopped = false;
+	int   childStatus = 0;
+	int   i;
+
+	memset(&lastUsage, 0, sizeof(lastUsage));
+
+	for (i = 0; i < count; i++){
+		if (pids[i] <= 0){
+			if (i == count - 1){
+				*status = 1 << 8;
+			}
+			continue;
+		}
+		if (timeoutArmed == true){
+			waitDeadline(&pids[i], 1, pgid);
+		}
+		while (wait4(pids[i], &childStatus, (jobControl == true) ? WUNTRACED : 0, &stageUsage) < 0 && 
+		       errno == EINTR){
+		}
+		addUsage(&lastUsage, &stageUsage);
+		if (WIFSTOPPED(childStatus)){
+			stopped = true;
+			break;
+		}
+		if (WIFSIGNALED(childStatus) && WTERMSIG(childStatus) == SIGINT){
+			lineInterrupted = true;
+		}
+		if (i == count - 1){
+			*status = childStatus;
+		}
+	}
+
+	if (handedOver == true){
+		takeTerminal();
+	}
+	lastWall = secondsSince(&commandStart);
+	lastUsageValid = true;
+	if (usageSink != NULL){
+		addUsage(usageSink, &lastUsage);
+	}
+	if (stopped == false){
+		//The ^C left the cursor after the echoed "^C".
+		if (jobControl == true && WIFSIGNALED(childStatus) && WTERMSIG(childStatus) == SIGINT){
+			printf("\n");
+			fflush(stdout);
+		}
+		return false;
+	}
+
+	*status = (128 + WSTOPSIG(childStatus)) << 8;
+	if (fgJob == NULL){
+		joinTokens(jobLine, sizeof(jobLine));
+		fgJob = addJob((pids[count - 1] > 0) ? pids[count - 1] : pids[i], pgid, jobLine);
+	}
+	fgJob->state = JOB_STOPPED;
+	runningJobs--;
+	printf("\n[%d] Stopped   %s\n", fgJob->id, fgJob->cmdLine);
+	fflush(stdout);
+	return true;
+}
+
+/*****************************************************************
+*
+* Function name : giveTerminal / takeTerminal
+*
+* Description : Terminal handoff. The foreground process group of
+*               the terminal is set to the job's while it runs (so
+*               it can read it, and ^C / ^Z go to it) and back to
+*               the shell's afterwards, when the shell's terminal
+*               modes are restored as well. SIGTTOU is blocked
+*               around tcsetpgrp since the shell is not the
+*               foreground group when it takes the terminal back.
+*
+* inputs       : pgid
+* outputs      : giveTerminal : false if there was nothing to do
+*               (no group of its own, no terminal, or the shell
+*               itself is not in the foreground).
+*
+*****************************************************************/
+bool giveTerminal(pid_t pgid){
+
+	sigset_t ttouMask, oldMask;
+
+	if (pgid <= 0 || isatty(STDIN_FILENO) == 0 || tcgetpgrp(STDIN_FILENO) != getpgrp()){
+		return false;
+	}
+	sigemptyset(&ttouMask);
+	sigaddset(&ttouMask, SIGTTOU);
+	sigprocmask(SIG_BLOCK, &ttouMask, &oldMask);
+	tcsetpgrp(STDIN_FILENO, pgid);
+	sigprocmask(SIG_SETMASK, &oldMask, NULL);
+	return true;
+}
+
+void takeTerminal(){
+
+	sigset_t ttouMask, oldMask;
+
+	sigemptyset(&ttouMask);
+	sigaddset(&ttouMask, SIGTTOU);
+	sigprocmask(SIG_BLOCK, &ttouMask, &oldMask);
+	tcsetpgrp(STDIN_FILENO, getpgrp());
+	if (jobControl == true){
+		tcsetattr(STDIN_FILENO, TCSADRAIN, &shellModes);
+	}
+	sigprocmask(SIG_SETMASK, &oldMask, NULL);
+}
+
+/*****************************************************************
+*
+* Function name : childSignals / jobSpawnAttrs
+*
+* Description : What a child needs under job control : ^C, ^Z and
+*               the terminal stop signals back at their defaults
+*               (the shell ignores or catches them). childSignals is
+*               for forked children; jobSpawnAttrs sets up the
+*               posix_spawn attributes for a child in process group
+*               pgid (0 : a new one) with the same defaults. Without
+*               job control the child stays in the shell's group.
+*
+* inputs       : attrs, pgid
+* outputs      : None
+*
+*****************************************************************/
+void childSignals(){
+
+	if (jobControl == true){
+		signal(SIGINT, SIG_DFL);
+		signal(SIGTSTP, SIG_DFL);
+		signal(SIGTTIN, SIG_DFL);
+		signal(SIGTTOU, SIG_DFL);
+	}
+}
+
+void jobSpawnAttrs(posix_spawnattr_t* attrs, pid_t pgid){
+
+	sigset_t defaults;
+	short    flags = 0;
+
+	posix_spawnattr_init(attrs);
+	if (jobControl == true){
+		flags |= POSIX_SPAWN_SETPGROUP;
+		posix_spawnattr_setpgroup(attrs, pgid);
+		sigemptyset(&defaults);
+		sigaddset(&defaults, SIGINT);
+		sigaddset(&defaults, SIGTSTP);
+		sigaddset(&defaults, SIGTTIN);
+		sigaddset(&defaults, SIGTTOU);
+		posix_spawnattr_setsigdefault(attrs, &defaults);
+		flags |= POSIX_SPAWN_SETSIGDEF;
+	}
+	posix_spawnattr_setflags(attrs, flags);
+}
+
+/*****************************************************************
+*
+* Function name : progfork
+*
+*
+* Description   :
+*				This will fork the current running program. 
+*               This process spawns children processes from it. 
+*				The new children made from this function
+*				can run built-in redirectional commands. Once this
+*				is done running it will then check the parents.
+*
+*
+******************************************************************/
+void progFork(){
+
+	long long spanStart;
+
+	//echo/printf output is still sitting in stdio; it has to reach
+	// the terminal before anything the child writes.
+	fflush(stdout);
+	clock_gettime(CLOCK_MONOTONIC, &commandStart);
+	syncScriptOffset();
+	//More than one stage : a "|" pipeline.
+	if (numStages > 1){
+		runPipeline();
+		resumeScriptOffset();
+		return;
+	}
+	//Open the redirection targets once, in the parent, so a bad
+	// file is reported before anything is started. Both launch
+	// paths below use the same descriptors.
+	spanStart = traceBegin();
+	if (openRedirects(&lineStages[0]) == false){
+		traceEnd("redirect-open", spanStart, lineStages[0].args[0]);
+		if (backgrFlag == false){
+			exitTheChild = 1 << 8;
+		}
+		resumeScriptOffset();
+		return;
+	}
+	traceEnd("redirect-open", spanStart, lineStages[0].args[0]);
+	//Fast path : posix_spawn. Only fall through to fork when
+	// spawn could not express the command, or ulimit settings have
+	// to be applied in the child.
+	if (spawnEnabled == true && limitsActive == false && spawnCmd() == true){
+		closeRedirects(&lineStages[0]);
+		resumeScriptOffset();
+		return;
+	}
+	//Resolve the command here rather than in the child so the
+	// cache (and its hit counts) lives in the shell and every later
+	// fork inherits the entry.
+	lookupCmd(lineStages[0].args[0]);
+	//Create child process with fork. Flush first or the child
+	// inherits (and later prints) anything still buffered.
+	fflush(stdout);
+	spanStart = traceBegin();
+	forkProcess = fork();
+	//Roll through child commands
+	if(forkProcess == 0){
+		if (jobControl == true){
+			setpgid(0, 0);
+		}
+		childSignals();
+		applyLimits();
+		redirectionCms();								
+	}
+	//Check Parent case
+	else{
+		//Set the group from this side too, before the terminal is
+		// handed to it.
+		traceEnd("fork", spanStart, lineStages[0].args[0]);
+		if (jobControl == true){
+			setpgid(forkProcess, forkProcess);
+			forkPgid = forkProcess;
+		}
+		closeRedirects(&lineStages[0]);
+		checkParents();
+		forkPgid = 0;
+		resumeScriptOffset();
+	}
+}
+
+/*****************************************************************
+*
+* Function name : spawnCmd
+*
+*
+* Description   :
+*				Launches the (single stage) command line with
+*				posix_spawn instead of fork. glibc implements posix_spawn with a
+*				vfork-style clone, so the child shares our memory
+*				until it execs and the cost of a launch no longer
+*				grows with the size of the shell.
+*
+*				The redirections have already been opened by
+*				progFork() (close-on-exec so nothing leaks) and are
+*				handed to the child as dup2/close file actions.
+*				Under job control the child also gets a process
+*				group of its own.
+*
+* Input  : None (reads lineStages and backgrFlag)
+*
+* Output : true when the command was handled (started or reported
+*		   as an error), false when the caller should fall back to
+*		   the fork path. Currently that only happens for scripts
+*		   without a #! line (ENOEXEC): execCmd hands those to
+*		   /bin/sh but posix_spawn does not.
+*
+******************************************************************/
+bool spawnCmd(){
+
+	char** spawnArgs = lineStages[0].args;
+	long long spanStart;
+	int    spawnErr;
+	pid_t  spawnPid;
+	posix_spawn_file_actions_t fileActions;
+	posix_spawnattr_t attrs;
+
+	posix_spawn_file_actions_init(&fileActions);
+	addRedirectActions(&lineStages[0], &fileActions);
+	if (jobControl == true){
+		jobSpawnAttrs(&attrs, 0);
+	}
+
+	fflush(stdout);
+	spanStart = traceBegin();
+	spawnErr = spawnResolved(&spawnPid, spawnArgs, &fileActions, (jobControl == true) ? &attrs : NULL);
+	traceEnd("spawn", spanStart, spawnArgs[0]);
+	posix_spawn_file_actions_destroy(&fileActions);
+	if (jobControl == true){
+		posix_spawnattr_destroy(&attrs);
+	}
+
+	//Script without an interpreter line : let execCmd deal with it.
+	if (spawnErr == ENOEXEC){
+		return false;
+	}
+	//Command could not be found or executed.
+	if (spawnErr != 0){
+		errno = spawnErr;
+		perror("Error : ");
+		printf(" ' %s ' does not exist as a file or directory and cannot be found. \n", spawnArgs[0]);
+		fflush(stdout);
+		if (backgrFlag == false){
+			exitTheChild = 1 << 8;
+		}
+		return true;
+	}
+
+	//Same bookkeeping as a forked child from here on.
+	forkProcess = spawnPid;
+	forkPgid = (jobControl == true) ? spawnPid : 0;
+	checkParents();
+	forkPgid = 0;
+	return true;
+}
+
+
+/*****************************************************************
+*
+* Function name : openRedirects
+*
+*
+* Description   :
+*			Opens the file targets of a stage's redirections in the
+*			parent, once each, close-on-exec so they never leak
+*			into anything but the child they are dup2'd into.
+*			">" truncates, ">>" appends.
+*
+*			"N>&M" is checked here as well : M has to be open in
+*			the shell (and not one of its private close-on-exec
+*			descriptors) or set up by an earlier redirection of
+*			the same stage.
+*
+*			An opened descriptor that is also the number of one
+*			of the stage's redirections would be overwritten
+*			before it is used, so it is moved out of the way.
+*
+* Input  : stage
+*
+* Output : openFd of each redirection. Returns false after printing
+*		   an error if something could not be opened, in which case
+*		   nothing is left open.
+*
+*****************************************************************/
+bool openRedirects(struct pipeStage* stage){
+
+	struct redirect* redir;
+	unsigned int defined = 0;
+	int flags, moved, i, j;
+
+	for (i = 0; i < stage->numRedirs; i++){
+		redir = &stage->redirs[i];
+		redir->openFd = -1;
+		if (redir->mode == REDIR_DUP){
+			if ((defined & (1u << redir->source)) == 0 &&
+			    ((flags = fcntl(redir->source, F_GETFD)) < 0 || (flags & FD_CLOEXEC))){
+				printf("Error : %d : bad file descriptor\n", redir->source);
+				fflush(stdout);
+				closeRedirects(stage);
+				return false;
+			}
+			defined |= 1u << redir->fd;
+			continue;
+		}
+		if (redir->mode == REDIR_CLOSE){
+			defined &= ~(1u << redir->fd);
+			continue;
+		}
+
+		if (redir->mode == REDIR_IN){
+			flags = O_RDONLY;
+		}else if (redir->mode == REDIR_APPEND){
+			flags = O_CREAT | O_WRONLY | O_APPEND;
+		}else{
+			flags = O_CREAT | O_WRONLY | O_TRUNC;
+		}
+		redir->openFd = open(redir->target, flags | O_CLOEXEC, 0755);
+		if (redir->openFd < 0){
+			perror("Error : ");
+			printf("A bad file has been given to the program. ' %s ' cannot be opened. \n", redir->target);
+			fflush(stdout);
+			closeRedirects(stage);
+			return false;
+		}
+		defined |= 1u << redir->fd;
+	}
+
+	for (i = 0; i < stage->numRedirs; i++){
+		redir = &stage->redirs[i];
+		if (redir->openFd < 0 || redir->openFd >= REDIR_FD_LIMIT){
+			continue;
+		}
+		for (j = 0; j < stage->numRedirs; j++){
+			if (stage->redirs[j].fd == redir->openFd){
+				moved = fcntl(redir->openFd, F_DUPFD_CLOEXEC, REDIR_FD_LIMIT);
+				close(redir->openFd);
+				redir->openFd = moved;
+				break;
+			}
+		}
+	}
+	return true;
+}
+
+/*****************************************************************
+*
+* Function name : closeRedirects
+*
+* Description : Closes the shell's copies of a stage's redirection
+*               targets once the child has been started.
+*
+* Input  : stage
+* Output : None
+*
+*****************************************************************/
+void closeRedirects(struct pipeStage* stage){
+
+	int i;
+
+	for (i = 0; i < stage->numRedirs; i++){
+		if (stage->redirs[i].openFd >= 0){
+			close(stage->redirs[i].openFd);
+			stage->redirs[i].openFd = -1;
+		}
+	}
+}
+
+/*****************************************************************
+*
+* Function name : applyRedirects
+*
+* Description : Applies a stage's redirections, in order, to the
+*               calling process : the fork children, and the shell
+*               itself around a built in.
+*
+* Input  : stage (opened by openRedirects)
+* Output : false with errno set if a dup2 failed
+*
+*****************************************************************/
+bool applyRedirects(struct pipeStage* stage){
+
+	struct redirect* redir;
+	int i;
+
+	for (i = 0; i < stage->numRedirs; i++){
+		redir = &stage->redirs[i];
+		if (redir->mode == REDIR_CLOSE){
+			close(redir->fd);
+		}else if (dup2((redir->mode == REDIR_DUP) ? redir->source : redir->openFd, redir->fd) < 0){
+			return false;
+		}
+	}
+	return true;
+}
+
+/*****************************************************************
+*
+* Function name : addRedirectActions
+*
+* Description : The posix_spawn version of applyRedirects : the same
+*               redirections as dup2/close file actions. dup2 clears
+*               close-on-exec on the target, so only the descriptors
+*               named here survive into the child.
+*
+* Input  : stage, fileActions
+* Output : fileActions
+*
+*****************************************************************/
+void addRedirectActions(struct pipeStage* stage, posix_spawn_file_actions_t* fileActions){
+
+	struct redirect* redir;
+	int i;
+
+	for (i = 0; i < stage->numRedirs; i++){
+		redir = &stage->redirs[i];
+		if (redir->mode == REDIR_CLOSE){
+			posix_spawn_file_actions_addclose(fileActions, redir->fd);
+		}else{
+			posix_spawn_file_actions_adddup2(fileActions,
+			    (redir->mode == REDIR_DUP) ? redir->source : redir->openFd, redir->fd);
+		}
+	}
+}
+
+/*****************************************************************
+*
+* Function name : spawnResolved
+*
+* Description : posix_spawn on the cached path of cArg[0]. If the
+*               cached binary has gone away the entry is dropped and
+*               PATH is searched once more before giving up.
+*
+* Input  : cArg, fileActions, attrs (may be NULL)
+* Output : pid of the child, 0 or the error posix_spawn returned.
+*
+*****************************************************************/
+int spawnResolved(pid_t* pid, char* cArg[], posix_spawn_file_actions_t* fileActions,
+                  posix_spawnattr_t* attrs){
+
+	char* cmdPath = lookupCmd(cArg[0]);
+	int   spawnErr;
+
+	if (cmdPath == NULL){
+		return ENOENT;
+	}
+	spawnErr = posix_spawn(pid, cmdPath, fileActions, attrs, cArg, environ);
+	//The cached binary went away : forget it and walk PATH again.
+	if (spawnErr == ENOENT && strchr(cArg[0], '/') == NULL){
+		forgetCmd(cArg[0]);
+		cmdPath = lookupCmd(cArg[0]);
+		if (cmdPath != NULL){
+			spawnErr = posix_spawn(pid, cmdPath, fileActions, attrs, cArg, environ);
+		}
+	}
+	return spawnErr;
+}
+
+/*****************************************************************
+*
+* Function name : runPipeline
+*
+*
+* Description   :
+*			Runs "cmd1 | cmd2 | ... | cmdN" from lineStages. Every
+*			stage is started right away so they all run at the same
+*			time, connected by pipes.
+*			Only two pipe ends are ever held open in the shell :
+*			the read end feeding the next stage and the write end
+*			of the pipe being created for it.
+*
+*			All stages go into one process group, led by the first
+*			stage that started. A foreground pipeline is handed the
+*			terminal while it runs (waitForegroundJob) so stages
+*			reading from it do not get stopped by SIGTTIN, and the
+*			shell takes it back once everything is done or stopped.
+*
+*			Foreground : wait for every stage, exitTheChild gets
+*						 the status of the last one.
+*			Background : report and track the last stage like a
+*						 normal background command.
+*
+* Input  : None (reads lineStages and backgrFlag)
+* Output : Error messages for stages that could not be started.
+*
+*****************************************************************/
+void runPipeline(){
+
+	pid_t* stagePids = arenaAlloc(&lineArena, numStages * sizeof(pid_t));
+	struct pipeStage* stages = lineStages;
+	int    i;
+	int    pipeFds[2];
+	int    prevRead = -1;
+	pid_t  pgid = 0;
+	long long spanStart;
+
+	fflush(stdout);
+	for (i = 0; i < numStages; i++){
+		stagePids[i] = -1;
+		pipeFds[0] = -1;
+		pipeFds[1] = -1;
+		if (i < numStages - 1 && pipe2(pipeFds, O_CLOEXEC) < 0){
+			perror("Error : ");
+			fflush(stdout);
+			break;
+		}
+
+		//A stage's own redirections are applied after the pipe
+		// ends, so they win over it.
+		if (openRedirects(&stages[i]) == true){
+			stagePids[i] = launchStage(&stages[i], prevRead, pipeFds[1], pipeFds[0], pgid);
+			//Without job control every stage stays in our group.
+			if (stagePids[i] > 0 && pgid == 0 && jobControl == true){
+				pgid = stagePids[i];
+			}
+			closeRedirects(&stages[i]);
+		}
+
+		//The child has its copies now; neighbours see EOF/EPIPE
+		// as soon as the stage on the other end exits.
+		if (prevRead >= 0){
+			close(prevRead);
+		}
+		if (pipeFds[1] >= 0){
+			close(pipeFds[1]);
+		}
+		prevRead = pipeFds[0];
+	}
+	if (prevRead >= 0){
+		close(prevRead);
+	}
+
+	//Background pipeline : the last stage stands for the whole thing.
+	if (backgrFlag == true){
+		if (stagePids[numStages - 1] > 0){
+			forkProcess = stagePids[numStages - 1];
+			forkPgid = pgid;
+			checkParents();
+			forkPgid = 0;
+		}
+		return;
+	}
+
+	spanStart = traceBegin();
+	waitForegroundJob(stagePids, numStages, pgid, &exitTheChild, NULL);
+	traceEnd("wait", spanStart, NULL);
+}
+
+/*****************************************************************
+*
+* Function name : launchStage
+*
+*
+* Description   :
+*			Starts one pipeline stage with inFd/outFd as its stdin
+*			and stdout (-1 leaves the shell's own), then the
+*			stage's own redirections on top. spareFd is the read
+*			end of the stage's output pipe which the child must
+*			not keep open.
+*
+*			posix_spawn is used when it is enabled and the stage is
+*			an ordinary program; the process group (job control
+*			only) is set through the spawn attributes. Splice stages, --fork mode,
+*			ulimit settings and scripts without a #! line go
+*			through fork(). So do built ins, which run in the
+*			forked copy of the shell (without job control) so that
+*			"... | parallel -- cmd {}" or "history | grep x" work.
+*
+* Input  : stage, inFd, outFd, spareFd, pgid (0 = start a new group)
+*
+* Output : pid of the stage, or -1 (after an error message) if it
+*		   could not be started.
+*
+*****************************************************************/
+pid_t launchStage(struct pipeStage* stage, int inFd, int outFd, int spareFd, pid_t pgid){
+
+	posix_spawn_file_actions_t fileActions;
+	posix_spawnattr_t attrs;
+	pid_t stagePid = -1;
+	long long spanStart;
+	int   spawnErr = ENOEXEC;
+	int   result;
+	bool  spliced = (spliceEnabled == true && isSpliceStage(stage->args) == true);
+	const struct builtin* builtinCmd = findBuiltin(stage->args[0]);
+
+	if (spawnEnabled == true && spliced == false && limitsActive == false && builtinCmd == NULL){
+		posix_spawn_file_actions_init(&fileActions);
+		if (inFd >= 0){
+			posix_spawn_file_actions_adddup2(&fileActions, inFd, 0);
+		}
+		if (outFd >= 0){
+			posix_spawn_file_actions_adddup2(&fileActions, outFd, 1);
+		}
+		addRedirectActions(stage, &fileActions);
+		jobSpawnAttrs(&attrs, pgid);
+		spanStart = traceBegin();
+		spawnErr = spawnResolved(&stagePid, stage->args, &fileActions, &attrs);
+		traceEnd("spawn", spanStart, stage->args[0]);
+		posix_spawnattr_destroy(&attrs);
+		posix_spawn_file_actions_destroy(&fileActions);
+
+		if (spawnErr == 0){
+			return stagePid;
+		}
+		if (spawnErr != ENOEXEC){
+			errno = spawnErr;
+			perror("Error : ");
+			printf(" ' %s ' does not exist as a file or directory and cannot be found. \n", stage->args[0]);
+			fflush(stdout);
+			return -1;
+		}
+	}
+
+	spanStart = traceBegin();
+	stagePid = fork();
+	if (stagePid == 0){
+		if (jobControl == true){
+			setpgid(0, pgid);
+		}
+		signal(SIGTSTP, SIG_DFL);
+		childSignals();
+		applyLimits();
+		if (inFd >= 0){
+			dup2(inFd, 0);
+		}
+		if (outFd >= 0){
+			dup2(outFd, 1);
+		}
+		if (spareFd >= 0){
+			close(spareFd);
+		}
+		if (applyRedirects(stage) == false){
+			perror("Error : ");
+			fflush(stdout);
+			exit(1);
+		}
+		if (spliced == true){
+			spliceStage(stage->args);
+		}
+		if (builtinCmd != NULL){
+			jobControl = false;
+			result = builtinCmd->run(stage->args);
+			fflush(stdout);
+			if (result != BUILTIN_EXTERNAL){
+				exit(result & 0xff);
+			}
+		}
+		execCmd(stage->args);
+		perror("Error : ");
+		printf(" ' %s ' does not exist as a file or directory and cannot be found. \n", stage->args[0]);
+		fflush(stdout);
+		exit(1);
+	}
+	if (stagePid < 0){
+		perror("Error : ");
+		fflush(stdout);
+		return -1;
+	}
+	traceEnd("fork", spanStart, stage->args[0]);
+	//Set it from this side too so the group exists before the
+	// next stage tries to join it.
+	if (jobControl == true){
+		setpgid(stagePid, (pgid == 0) ? stagePid : pgid);
+	}
+	return stagePid;
+}
+
+/*****************************************************************
+*
+* Function name : isSpliceStage
+*
+* Description : True for the stages the --splice fast path knows how
+*               to run : "cat" with no arguments and "tee FILE".
+*
+* Input  : args
+* Output : Bool
+*
+*****************************************************************/
+bool isSpliceStage(char* args[]){
+
+	if (strEquals(args[0], "cat") == true && args[1] == NULL){
+		return true;
+	}
+	if (strEquals(args[0], "tee") == true && args[1] != NULL && args[1][0] != '-' && 
+	    args[2] == NULL){
+		return true;
+	}
+	return false;
+}
+
+/*****************************************************************
+*
+* Function name : spliceStage
+*
+*
+* Description   :
+*			Body of a --splice stage, run in the forked child with
+*			stdin/stdout already in place.
+*
+*			cat     : splice() stdin straight to stdout.
+*			tee FILE: tee() duplicates what is waiting in the stdin
+*					  pipe into the stdout pipe without consuming
+*					  it, then splice() moves the same number of
+*					  bytes into FILE.
+*
+*			splice needs a pipe on at least one side (tee needs
+*			pipes on both). When that is not the case the stage
+*			falls back to exec'ing the real program.
+*
+* Input  : args
+* Output : Does not return when the fast path was taken.
+*
+*****************************************************************/
+void spliceStage(char* args[]){
+
+	struct stat inInfo, outInfo;
+	ssize_t dupBytes, moved;
+	int fileFd;
+
+	if (args[1] == NULL){
+		if (spliceCopy(0, 1) == true){
+			exit(0);
+		}
+		return;
+	}
+
+	if (fstat(0, &inInfo) < 0 || fstat(1, &outInfo) < 0 ||
+	    S_ISFIFO(inInfo.st_mode) == false || S_ISFIFO(outInfo.st_mode) == false){
+		return;
+	}
+	fileFd = open(args[1], O_CREAT | O_WRONLY | O_TRUNC, 0644);
+	if (fileFd < 0){
+		perror("tee");
+		exit(1);
+	}
+	while ((dupBytes = tee(0, 1, SPLICE_CHUNK, 0)) > 0){
+		while (dupBytes > 0){
+			moved = splice(0, NULL, fileFd, NULL, dupBytes, SPLICE_F_MOVE);
+			if (moved <= 0){
+				perror("tee");
+				exit(1);
+			}
+			dupBytes -= moved;
+		}
+	}
+	exit(dupBytes < 0);
+}
+
+/*****************************************************************
+*
+* Function name : spliceCopy
+*
+* Description : Copies inFd to outFd with splice() until EOF.
+*
+* Input  : inFd, outFd
+* Output : false if splice cannot be used on this pair of fds (the
+*          kernel says EINVAL before any data has moved).
+*
+*****************************************************************/
+bool spliceCopy(int inFd, int outFd){
+
+	ssize_t moved;
+	bool started = false;
+
+	while ((moved = splice(inFd, NULL, outFd, NULL, SPLICE_CHUNK, SPLICE_F_MOVE)) > 0){
+		started = true;
+	}
+	if (moved < 0 && started == false && errno == EINVAL){
+		return false;
+	}
+	if (moved < 0){
+		perror("cat");
+		exit(1);
+	}
+	return true;
+}
+
+
+/*****************************************************************
+*
+* Function name : checkParents
+*
+*
+* Description   :
+*				 This rolls through parent processes and either
+*				  will set them to sleep and wait for child processes
+*				  to finish. It keeps track of the parent process count
+*				  each time this function is ran it will increase that count.
+*				  It will then output the background process ID for any process
+*				  that passes through this function. If the background processes falg
+*				  is found to not be set throughout the execution of the program / process
+*				  then it will make the parent process wait for the child to be executed.
+*
+*
+* Input  : None
+* Output : process ID numbers in the form of a print statement.
+*
+******************************************************************/
+void checkParents(){
+
+	long long spanStart = traceBegin();
+
+	if (backgrFlag == true){
+		//The reaper picks it up once SIGCHLD says it is done.
+		char jobLine[MAXIMUM_NUM_CHARACTERS];
+		joinTokens(jobLine, sizeof(jobLine));
+		struct job* newJob = addJob(forkProcess, forkPgid, jobLine);
+		lastBackground = forkProcess;
+		backgrFlag = false;
+		printf("\n");
+		printf(" [%d] background pid for the process : %d \n", newJob->id, forkProcess);
+
+		fflush(stdout);
+		traceEnd("background", spanStart, newJob->cmdLine);
+	}else if(backgrFlag == false){
+		//Make the parent wait.
+		waitForegroundJob(&forkProcess, 1, forkPgid, &exitTheChild, NULL);
+		traceEnd("wait", spanStart, NULL);
+		}
+}
+
+
+/*****************************************************************
 *
+* Function name : redirectionCms
+*
+*
+* Description   :
+*           Child side of the fork path. The redirection targets were
+*			opened by progFork() before the fork, so all that is left
+*			is to apply every redirection, in order, and only then
+*			exec the command.
+*
+* Inputs : None (lineStages[0])
+*
+* Outputs : Only returns by exiting. An error message is printed if
+*			the command could not be run.
+*
+******************************************************************/
+void redirectionCms(){
+
+	char** cmdArg = lineStages[0].args;
+	long long spanStart = traceBegin();
+
+	if (applyRedirects(&lineStages[0]) == false){
+		perror("Error : ");
+		fflush(stdout);
+		exit(1);
+	}
+
+	traceEnd("redirect-apply", spanStart, cmdArg[0]);
+
+	//execCmd only comes back when the exec failed.
+	execCmd(cmdArg);
+	perror("Error : ");
+	printf(" ' %s ' does not exist as a file or directory and cannot be found. \n", cmdArg[0]);	//If error then ouput issue
+	fflush(stdout);
+	exit(1);
+
+}
+
+
+/*****************************************************************
+*
+* Function name : execCmd
+*
+*
+* Description   :
+*			Replaces the current (child) process with the command
+*			in cArg. The path comes from the command cache so PATH
+*			is not walked again, and execve is called on it
+*			directly. execvp would normally do two things for us
+*			that execve does not, so they are handled here :
+*			  * a script with no #! line (ENOEXEC) is run by /bin/sh
+*			  * a cached binary that has disappeared (ENOENT) falls
+*				back to a fresh PATH walk.
+*
+* Input  : cArg - NULL terminated argument list
+*
+* Output : Only returns if the exec failed, with errno set.
+*
+*****************************************************************/
+void execCmd(char* cArg[]){
+
+	char** shArgs;
+	char*  cmdPath = lookupCmd(cArg[0]);
+	int    i;
+
+	if (cmdPath == NULL){
+		errno = ENOENT;
+		return;
+	}
+	execve(cmdPath, cArg, environ);
+
+	if (errno == ENOEXEC){
+		for (i = 1; cArg[i] != NULL; i++){
+		}
+		shArgs = malloc((i + 2) * sizeof(char*));
+		shArgs[0] = "sh";
+		shArgs[1] = cmdPath;
+		for (i = 1; cArg[i] != NULL; i++){
+			shArgs[i + 1] = cArg[i];
+		}
+		shArgs[i + 1] = NULL;
+		execve("/bin/sh", shArgs, environ);
+	}else if (errno == ENOENT && strchr(cArg[0], '/') == NULL){
+		execvp(cArg[0], cArg);
+	}
+}
+
+/*****************************************************************
+*
+* Function name : hashName
+*
+* Description : FNV-1a hash of a command name, used to pick a bucket
+*               in cmdHashTable.
+*
+* Input  : name
+* Output : bucket index
+*
+*****************************************************************/
+unsigned int hashName(const char* name){
+
+	unsigned int h = 2166136261u;
+	while (*name != '\0'){
+		h ^= (unsigned char)*name++;
+		h *= 16777619u;
+	}
+	return h % HASH_BUCKETS;
+}
+
+/*****************************************************************
+*
+* Function name : lookupCmd
+*
+*
+* Description   :
+*			Turns a command name into the path that should be
+*			exec'd. Names containing a "/" are used as they are.
+*			Everything else is looked up in cmdHashTable first and
+*			only on a miss do we walk the PATH directories, which
+*			is the part that used to cost a failed execve per
+*			directory on every launch.
+*
+*			If PATH is not the one the table was built from, the
+*			table is emptied first. Hits from relative PATH entries
+*			(like ".") are not cached since they change with cd.
+*
+* Input  : name - the command word
+*
+* Output : Path to exec, or NULL if nothing executable was found.
+*		   The result points into the table (or a static buffer)
+*		   so it must not be freed.
+*
+*****************************************************************/
+char* lookupCmd(const char* name){
+
+	static char found[MAXIMUM_NUM_CHARACTERS];
+	const char* pathVar = getenv("PATH");
+	const char* dir;
+	const char* dirEnd;
+	struct hashEntry* entry;
+	struct stat fileInfo;
+	unsigned int bucket;
+	size_t dirLen;
+
+	if (strchr(name, '/') != NULL){
+		return (char*)name;
+	}
+	if (pathVar == NULL){
+		pathVar = "/bin:/usr/bin";
+	}
+
+	//PATH changed since we last looked : start over.
+	if (hashedPath == NULL || strEquals(hashedPath, pathVar) == false){
+		clearCmdHash();
+		free(hashedPath);
+		hashedPath = strdup(pathVar);
+	}
+
+	bucket = hashName(name);
+	for (entry = cmdHashTable[bucket]; entry != NULL; entry = entry->next){
+		if (strEquals(entry->name, name) == true){
+			entry->hits++;
+			hashHits++;
+			return entry->path;
+		}
+	}
+	hashMisses++;
+
+	//Miss : walk each directory of PATH. An empty entry means ".".
+	dir = pathVar;
+	while (true){
+		dirEnd = strchr(dir, ':');
+		dirLen = (dirEnd != NULL) ? (size_t)(dirEnd - dir) : strlen(dir);
+		if (dirLen == 0){
+			snprintf(found, sizeof(found), "./%s", name);
+		}else{
+			snprintf(found, sizeof(found), "%.*s/%s", (int)dirLen, dir, name);
+		}
+		if (stat(found, &fileInfo) == 0 && S_ISREG(fileInfo.st_mode) &&
+		    access(found, X_OK) == 0){
+			if (found[0] != '/'){
+				return found;
+			}
+			entry = malloc(sizeof(struct hashEntry));
+			entry->name = strdup(name);
+			entry->path = strdup(found);
+			entry->hits = 1;
+			entry->next = cmdHashTable[bucket];
+			cmdHashTable[bucket] = entry;
+			return entry->path;
+		}
+		if (dirEnd == NULL){
+			break;
+		}
+		dir = dirEnd + 1;
+	}
+	return NULL;
+}
+
+/*****************************************************************
+*
+* Function name : forgetCmd
+*
+* Description : Drops one name from the command cache. Used when the
+*               cached binary is gone (exec returned ENOENT).
+*
+* Input  : name
+* Output : None
+*
+*****************************************************************/
+void forgetCmd(const char* name){
+
+	struct hashEntry** link = &cmdHashTable[hashName(name)];
+	struct hashEntry* entry;
+
+	while ((entry = *link) != NULL){
+		if (strEquals(entry->name, name) == true){
+			*link = entry->next;
+			free(entry->name);
+			free(entry->path);
+			free(entry);
+			return;
+		}
+		link = &entry->next;
+	}
+}
+
+/*****************************************************************
+*
+* Function name : clearCmdHash
+*
+* Description : Empties the command cache and its hit counters.
+*
+* Input  : None
+* Output : None
+*
+*****************************************************************/
+void clearCmdHash(){
+
+	struct hashEntry* entry;
+	int i;
+
+	for (i = 0; i < HASH_BUCKETS; i++){
+		while ((entry = cmdHashTable[i]) != NULL){
+			cmdHashTable[i] = entry->next;
+			free(entry->name);
+			free(entry->path);
+			free(entry);
+		}
+	}
+	hashHits = 0;
+	hashMisses = 0;
+}
+
+/*****************************************************************
+*
+* Function name : hashCmd
+*
+* Description : The "hash" built in. With no arguments it prints
+*               every cached command with its hit count, followed by
+*               the overall hit rate. "hash -r" empties the cache.
+*
+* Input  : args - the command's arguments
+* Output : The table, or nothing for -r.
+*
+*****************************************************************/
+int hashCmd(char* args[]){
+
+	struct hashEntry* entry;
+	int lookups = hashHits + hashMisses;
+	int i;
+
+	if (args[1] != NULL && strEquals(args[1], "-r") == true){
+		clearCmdHash();
+		return 0;
+	}
+
+	printf("hits\tcommand\n");
+	for (i = 0; i < HASH_BUCKETS; i++){
+		for (entry = cmdHashTable[i]; entry != NULL; entry = entry->next){
+			printf("%4d\t%s\n", entry->hits, entry->path);
+		}
+	}
+	printf("lookups : %d  hits : %d  misses : %d  hit rate : %d%%\n", lookups,
+	       hashHits, hashMisses, (lookups > 0) ? (hashHits * 100) / lookups : 0);
+	fflush(stdout);
+	return 0;
+}
+
+/*****************************************************************
+* Function name : historyCmd
 *
+* Description :
+*	  history         : every line, numbered
+*	  history N       : the last N lines
+*	  history -p TEXT : the lines starting with TEXT
+*	  history -s TEXT : the lines containing TEXT
+*	The words after -p / -s are joined with single blanks, since
+*	there is no quoting. Both searches run memmem() over the
+*	whole mapped file rather than line by line, and look a hit's
+*	line number up in histLines with a binary search. The search
+*	command itself (the newest line) is left out. 1 if a search
+*	found nothing, 2 on a usage error.
+*
+* Input  : args
+* Output : exit code
 *****************************************************************/
-void attachChildpid(){
+int historyCmd(char* args[]){
+
+	bool   prefix;
+	char*  text;
+	char*  hit;
+	const char* entry;
+	size_t textLen = 0;
+	size_t len;
+	size_t at;
+	size_t pos = 0;
+	int    total = historyTotal();
+	int    first = 1;
+	int    found = 0;
+	int    low;
+	int    high;
+	int    i;
+
+	if (args[1] == NULL || isdigit((unsigned char)args[1][0])){
+		if (args[1] != NULL){
+			first = total - atoi(args[1]) + 1;
+		}
+		for (i = (first > 1) ? first : 1; i <= total; i++){
+			entry = historyEntry(i, &len);
+			printHistory(i, entry, len);
+		}
+		fflush(stdout);
+		return 0;
+	}
+	if ((strEquals(args[1], "-p") == false && strEquals(args[1], "-s") == false) || args[2] == NULL){
+		printf("usage : history [N] | history -p PREFIX | history -s TEXT\n");
+		fflush(stdout);
+		return 2;
+	}
+	prefix = strEquals(args[1], "-p");
+
+	for (i = 2; args[i] != NULL; i++){
+		textLen += strlen(args[i]) + 1;
+	}
+	text = arenaAlloc(&lineArena, textLen);
+	text[0] = '\0';
+	for (i = 2; args[i] != NULL; i++){
+		if (i > 2){
+			strcat(text, " ");
+		}
+		strcat(text, args[i]);
+	}
+	textLen = strlen(text);
+
+	while (pos < histMapLen && (hit = memmem(histMap + pos, histMapLen - pos, text, textLen)) != NULL){
+		at = hit - histMap;
+		low = 0;
+		high = histMapCount - 1;
+		while (low < high){
+			i = (low + high + 1) / 2;
+			if (histLines[i] <= at){
+				low = i;
+			}else{
+				high = i - 1;
+			}
+		}
+		entry = historyEntry(low + 1, &len);
+		if (prefix == false || at == histLines[low]){
+			printHistory(low + 1, entry, len);
+			found++;
+		}
+		//One listing per line, whatever else on it matches.
+		pos = histLines[low] + len + 1;
+	}
+	for (i = 0; i < histSessionCount - 1; i++){
+		len = strlen(histSession[i]);
+		if (historyMatch(histSession[i], len, text, textLen, prefix) == true){
+			printHistory(histMapCount + i + 1, histSession[i], len);
+			found++;
+		}
+	}
+	fflush(stdout);
+	return (found > 0) ? 0 : 1;
+}
 
-	//Initialize the command line and kill line
-	char cmdLine[MAXIMUM_NUM_CHARACTERS] = { 0 };
-	//Get pid to add later.
-	char temp_pid = getpid();
+void printHistory(int number, const char* text, size_t len){
 
-	strcpy(proginp, strncpy(cmdLine, proginp, (strlen(proginp) - 11)));
-	//Here we add the PID to the end of the cmdLine
-	sprintf(cmdLine, "%d" , temp_pid);
-	//We then copy it into our proginp
-	strcpy(proginp, cmdLine);
-	
+	printf("%5d  %.*s\n", number, (int)len, text);
 }
 
 /***************************************************************
@@ -712,7 +8102,7 @@ void initSigs(){
 
 	struct sigaction SIGINT_action = { 0 };		
 	struct sigaction SIGTSTP_action = { 0 };
-    struct sigaction ignore_action = { 0 };		
+	struct sigaction SIGCHLD_action = { 0 };
 
 	SIGINT_action.sa_handler = SIG_IGN;		
 	sigfillset(&SIGINT_action.sa_mask);
@@ -722,15 +8112,346 @@ void initSigs(){
 	sigfillset(&SIGTSTP_action.sa_mask);
 	sigaction(SIGTSTP, &SIGTSTP_action, NULL);
 
+	//Child exits wake the reaper through the self pipe. SA_RESTART
+	// keeps reads and waits from failing with EINTR every time a
+	// background job finishes.
+	pipe2(childPipe, O_NONBLOCK | O_CLOEXEC);
+	SIGCHLD_action.sa_handler = catchSIGCHLD;
+	sigfillset(&SIGCHLD_action.sa_mask);
+	SIGCHLD_action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigaction(SIGCHLD, &SIGCHLD_action, NULL);
+
+}
+
+/***************************************************************
+*
+* Function name : initJobControl
+*
+* Description : 
+*  Turns job control on for an interactive terminal. The shell
+*  waits until it is in the foreground, moves into a process
+*  group of its own and takes the terminal. From then on it
+*  ignores SIGTTIN / SIGTTOU, and SIGCHLD also reports children
+*  that stop so stopped background jobs can be listed.
+*
+* Input  : None (batchMode, noJobControl)
+*
+* Output : jobControl, shellModes
+*
+************************************************************/
+
+void initJobControl(){
+
+	struct sigaction ignore_action = { 0 };
+	struct sigaction SIGCHLD_action = { 0 };
+	pid_t shellPgid;
+
+	if (batchMode == true || noJobControl == true || isatty(STDIN_FILENO) == 0){
+		return;
+	}
+	//Started in the background : wait to be brought forward.
+	while (tcgetpgrp(STDIN_FILENO) != (shellPgid = getpgrp())){
+		kill(-shellPgid, SIGTTIN);
+	}
+
+	ignore_action.sa_handler = SIG_IGN;
+	sigaction(SIGTTIN, &ignore_action, NULL);
+	sigaction(SIGTTOU, &ignore_action, NULL);
+
+	//Fails harmlessly when we already lead a group (a session leader).
+	setpgid(0, 0);
+	tcsetpgrp(STDIN_FILENO, getpgrp());
+	tcgetattr(STDIN_FILENO, &shellModes);
+
+	SIGCHLD_action.sa_handler = catchSIGCHLD;
+	sigfillset(&SIGCHLD_action.sa_mask);
+	SIGCHLD_action.sa_flags = SA_RESTART;
+	sigaction(SIGCHLD, &SIGCHLD_action, NULL);
+	jobControl = true;
+}
+
+/***************************************************************
+*
+* Function name : parseOptions
+*
+* Description : 
+*  Handles the startup switches.
+*    --fork  : launch every command with fork() + exec
+*    --spawn : launch with posix_spawn (the default)
+*    --splice: move data through plain cat / tee FILE pipeline
+*              stages with splice() instead of running the programs
+*    -i      : prompt even when stdin is not a terminal
+*    --no-job-control : keep commands in the shell's process group
+*              on a terminal too
+*    --parse-bench : lex and parse the script without running it
+*              and print the cost per line
+*    --trace=FILE : write a Chrome trace of every command's phases
+*    FILE    : run the script FILE in batch mode
+*
+* Input  : argc, argv from main
+*
+* Output : Usage message on an unknown switch.
+*
+************************************************************/
+
+void parseOptions(int argc, char* argv[]){
+
+	int i;
+	for (i = 1; i < argc; i++){
+		if (strEquals(argv[i], "--fork") == true){
+			spawnEnabled = false;
+		}else if (strEquals(argv[i], "--spawn") == true){
+			spawnEnabled = true;
+		}else if (strEquals(argv[i], "--splice") == true){
+			spliceEnabled = true;
+		}else if (strEquals(argv[i], "-i") == true){
+			forceInteractive = true;
+		}else if (strEquals(argv[i], "--no-job-control") == true){
+			noJobControl = true;
+		}else if (strEquals(argv[i], "--parse-bench") == true){
+			parseBench = true;
+		}else if (strncmp(argv[i], "--trace=", 8) == 0 && argv[i][8] != '\0'){
+			tracePath = argv[i] + 8;
+		}else if (argv[i][0] != '-' && scriptPath == NULL){
+			scriptPath = argv[i];
+		}else{
+			fprintf(stderr, "usage : %s [--fork | --spawn] [--splice] [-i] [--no-job-control]\n\t[--parse-bench] [--trace=FILE] [script]\n", argv[0]);
+			exit(2);
+		}
+	}
+}
+
+/***************************************************************
+*
+* Function name : runParseBench
+*
+* Description : 
+*  Microbenchmark for the front end. Every script line is copied
+*  back into proginp and run through lexLine() + parseLine()
+*  (expansion is left out; it happens per command as it runs)
+*  PARSE_BENCH_ROUNDS times (the copy is needed since lexing
+*  writes into the line). Nothing is executed. Prints the average
+*  cost of one line, copy included.
+*
+* Input  : None (the script, read like batch mode)
+*
+* Output : lines, tokens and nanoseconds per line.
+*
+************************************************************/
+
+void runParseBench(){
+
+	char*  savedLine = NULL;
+	size_t savedCap = 0;
+	size_t lineLen;
+	struct timespec startTime, endTime;
+	double totalNs = 0;
+	long   lines = 0, tokens = 0;
+	int    round;
+
+	while (readBatchLine() == true){
+		lineLen = strlen(proginp);
+		if (lineLen + 1 > savedCap){
+			savedCap = proginpCap;
+			savedLine = realloc(savedLine, savedCap);
+		}
+		memcpy(savedLine, proginp, lineLen + 1);
+		clock_gettime(CLOCK_MONOTONIC, &startTime);
+		for (round = 0; round < PARSE_BENCH_ROUNDS; round++){
+			memcpy(proginp, savedLine, lineLen + 1);
+			lexLine(proginp);
+			parseLine();
+			backgrFlag = false;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &endTime);
+		totalNs += (endTime.tv_sec - startTime.tv_sec) * 1e9 + (endTime.tv_nsec - startTime.tv_nsec);
+		tokens += numTokens;
+		lines++;
+	}
+	printf("lines : %ld  tokens : %ld  rounds : %d  ns/line : %.1f\n", lines, tokens,
+	       PARSE_BENCH_ROUNDS, (lines > 0) ? totalNs / ((double)lines * PARSE_BENCH_ROUNDS) : 0.0);
+	fflush(stdout);
+	free(savedLine);
+}
+
+/***************************************************************
+*
+* Function name : initTrace / traceBegin / traceEnd
+*
+* Description : 
+*  --trace=FILE. initTrace opens the file (O_APPEND, so forked
+*  children can add to it safely), starts the JSON array and
+*  allocates the span buffer and its text buffer once.
+*
+*  A span is traceBegin() ... traceEnd(name, start, detail) : one
+*  clock read at each end and a copy into traceRing, nothing else.
+*  Both are a single compare when tracing is off. detail (a command
+*  name) is copied since the arena it lives in is reused. A forked
+*  child can not use the ring (its copy dies with the exec), so in
+*  a child traceEnd writes the span out at once.
+*
+* Input  : name, start (from traceBegin), detail (may be NULL)
+*
+* Output : None
+*
+************************************************************/
+
+void initTrace(){
+
+	char header[TRACE_LINE];
+
+	if (tracePath == NULL){
+		return;
+	}
+	traceFd = open(tracePath, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+	if (traceFd < 0){
+		perror(tracePath);
+		exit(2);
+	}
+	tracePid = getpid();
+	traceRing = malloc(TRACE_RING * sizeof(struct traceEvent));
+	traceText = malloc(TRACE_RING * TRACE_LINE);
+	write(traceFd, header, snprintf(header, sizeof(header),
+	      "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"smallsh\"}},\n",
+	      tracePid));
+	atexit(traceClose);
+}
+
+long long traceBegin(){
+
+	struct timespec now;
+
+	if (traceFd < 0){
+		return 0;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+void traceEnd(const char* name, long long start, const char* detail){
+
+	struct traceEvent* event;
+	struct traceEvent  single;
+	char   line[TRACE_LINE];
+	pid_t  self;
+
+	if (traceFd < 0){
+		return;
+	}
+	self = getpid();
+	event = (self == tracePid) ? &traceRing[traceCount] : &single;
+	event->name = name;
+	event->start = start;
+	event->length = traceBegin() - start;
+	event->tid = self;
+	event->detail[0] = '\0';
+	if (detail != NULL){
+		strncat(event->detail, detail, TRACE_DETAIL - 1);
+	}
+
+	if (self != tracePid){
+		write(traceFd, line, traceFormat(line, event));
+		return;
+	}
+	if (++traceCount == TRACE_RING){
+		traceFlush();
+	}
+}
+
+/***************************************************************
+*
+* Function name : traceFormat / traceFlush / traceClose
+*
+* Description : 
+*  A span becomes one Chrome trace "complete" event (ph X, times
+*  in microseconds). traceFlush formats everything in the ring
+*  into traceText and writes it with a single write(). traceClose
+*  (atexit, shell only) flushes the rest and closes the array.
+*
+* Input  : out, event
+*
+* Output : traceFormat : length of the text.
+*
+************************************************************/
+
+size_t traceFormat(char* out, const struct traceEvent* event){
+
+	char   detail[2 * TRACE_DETAIL];
+	size_t used = 0;
+	const char* cursor;
+
+	//Command names are the only text that could need escaping.
+	for (cursor = event->detail; *cursor != '\0'; cursor++){
+		if (*cursor == '"' || *cursor == '\\'){
+			detail[used++] = '\\';
+		}
+		detail[used++] = ((unsigned char)*cursor < ' ') ? ' ' : *cursor;
+	}
+	detail[used] = '\0';
+
+	return snprintf(out, TRACE_LINE,
+	    "{\"name\":\"%s\",\"cat\":\"smallsh\",\"ph\":\"X\",\"ts\":%lld.%03lld,\"dur\":%lld.%03lld,"
+	    "\"pid\":%d,\"tid\":%d,\"args\":{\"cmd\":\"%s\"}},\n",
+	    event->name, event->start / 1000, event->start % 1000, event->length / 1000,
+	    event->length % 1000, tracePid, event->tid, detail);
+}
+
+void traceFlush(){
+
+	size_t used = 0;
+	int i;
+
+	for (i = 0; i < traceCount; i++){
+		used += traceFormat(traceText + used, &traceRing[i]);
+	}
+	if (used > 0){
+		write(traceFd, traceText, used);
+	}
+	traceCount = 0;
+}
+
+void traceClose(){
+
+	char footer[TRACE_LINE];
+
+	if (traceFd < 0 || getpid() != tracePid){
+		return;
+	}
+	traceFlush();
+	//Last element without a trailing comma.
+	write(traceFd, footer, snprintf(footer, sizeof(footer),
+	      "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"shell\"}}\n]\n",
+	      tracePid, tracePid));
+	close(traceFd);
+	traceFd = -1;
 }
 
-int main(){
+int main(int argc, char* argv[]){
 
+	parseOptions(argc, argv);
+	initTrace();
+	//$$ never changes, so it is formatted once.
+	smallShellpid = getpid();
+	smallShellpidLen = snprintf(smallShellpidString, sizeof(smallShellpidString), "%d", smallShellpid);
     initSigs();
+	initPwd();
+	initInput();
+	if (batchMode == false){
+		initHistory();
+	}
+	initJobControl();
+	if (parseBench == true){
+		runParseBench();
+		return 0;
+	}
 
     do{
   		processTracker();
-		readIn();
-		bCMDs();
+		if (readIn() == false){
+			break;
+		}
+		lineInterrupted = false;
+		runCommandList(lineTree);
 	}while(backgroundFlag == true);
-}
\ No newline at end of file
+	fflush(stdout);
+}